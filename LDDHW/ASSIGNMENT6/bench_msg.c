@@ -0,0 +1,223 @@
+// Userspace benchmark: message mode, one syscall per message against batches.
+//
+// Switches a FIFO device to message mode, then a producer and a consumer
+// thread move small messages through it, first with one write()/read() per
+// message, then with MY_IOCTL_CMD_ENQ_BATCH/DEQ_BATCH carrying -b messages
+// per call. Prints messages per second for each message size. -7 selects
+// the hw7.c ioctl numbers, for /dev/pchar.
+//
+//   make bench && ./bench_msg -d /dev/pseudo0 -b 64
+//   ./bench_msg -7 -d /dev/pchar
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/types.h>
+
+// From hw.c and hw7.c; both use this batch layout
+struct fifo_msg_batch {
+    __u64 iov;
+    __u32 count;
+    __u32 done;
+};
+
+#define MY_IOCTL_CMD_SET_MSG_MODE _IOW('M', 5, __u32)
+#define MY_IOCTL_CMD_ENQ_BATCH _IOWR('M', 6, struct fifo_msg_batch)
+#define MY_IOCTL_CMD_DEQ_BATCH _IOWR('M', 7, struct fifo_msg_batch)
+
+#define PCHAR_SET_MSG_MODE    _IOW('r', 4, __u32)
+#define PCHAR_ENQ_BATCH       _IOWR('r', 5, struct fifo_msg_batch)
+#define PCHAR_DEQ_BATCH       _IOWR('r', 6, struct fifo_msg_batch)
+
+#define MAX_BATCH 1024
+#define MAX_MSG 1024
+
+static const char *dev_path = "/dev/pseudo0";
+static unsigned long cmd_mode = MY_IOCTL_CMD_SET_MSG_MODE;
+static unsigned long cmd_enq = MY_IOCTL_CMD_ENQ_BATCH;
+static unsigned long cmd_deq = MY_IOCTL_CMD_DEQ_BATCH;
+static unsigned int batch_size = 64;
+static double seconds = 1.0;
+static volatile int stop;
+
+struct side {
+    int writer;
+    size_t size;              // message bytes
+    unsigned int batch;       // 0 = one read/write per message
+    unsigned long long msgs;
+    int err;
+};
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void wake_handler(int sig)
+{
+    (void)sig;
+}
+
+static void *side_fn(void *arg)
+{
+    struct side *s = arg;
+    char (*bufs)[MAX_MSG] = malloc(MAX_BATCH * MAX_MSG);
+    struct iovec *iov = calloc(MAX_BATCH, sizeof(*iov));
+    struct fifo_msg_batch b = { .iov = (__u64)(unsigned long)iov };
+    unsigned int i;
+    long n;
+    int fd;
+
+    fd = open(dev_path, s->writer ? O_WRONLY : O_RDONLY);
+    if (fd < 0 || !bufs || !iov) {
+        s->err = errno;
+        goto out;
+    }
+    memset(bufs, 'm', MAX_BATCH * MAX_MSG);
+
+    while (!stop) {
+        if (!s->batch) {
+            n = s->writer ? write(fd, bufs[0], s->size) : read(fd, bufs[0], MAX_MSG);
+            n = n < 0 ? n : 1;
+        } else {
+            // Dequeue writes the received lengths back, so reset them every time
+            for (i = 0; i < s->batch; i++) {
+                iov[i].iov_base = bufs[i];
+                iov[i].iov_len = s->writer ? s->size : MAX_MSG;
+            }
+            b.count = s->batch;
+            n = ioctl(fd, s->writer ? cmd_enq : cmd_deq, &b);
+        }
+        if (n < 0) {
+            if (errno != EINTR && !stop)
+                s->err = errno;
+            break;
+        }
+        s->msgs += n;
+    }
+out:
+    if (fd >= 0)
+        close(fd);
+    free(iov);
+    free(bufs);
+    return NULL;
+}
+
+// One timed run, returns messages per second or -1
+static double run(size_t size, unsigned int batch)
+{
+    struct side wr = { .writer = 1, .size = size, .batch = batch };
+    struct side rd = { .size = size, .batch = batch };
+    pthread_t wt, rt;
+    double start, elapsed;
+
+    stop = 0;
+    pthread_create(&rt, NULL, side_fn, &rd);
+    pthread_create(&wt, NULL, side_fn, &wr);
+
+    start = now();
+    usleep(seconds * 1e6);
+    stop = 1;
+    elapsed = now() - start;
+
+    pthread_kill(wt, SIGUSR1);
+    pthread_kill(rt, SIGUSR1);
+    pthread_join(wt, NULL);
+    pthread_join(rt, NULL);
+
+    if (wr.err || rd.err) {
+        fprintf(stderr, "%zu B, batch %u: %s\n", size, batch,
+                strerror(wr.err ? wr.err : rd.err));
+        return -1;
+    }
+    return rd.msgs / elapsed;
+}
+
+// Drop what a stopped run left queued, the next run must start empty
+static void drain(int fd)
+{
+    char buf[MAX_MSG];
+    int flags = fcntl(fd, F_GETFL);
+
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    while (read(fd, buf, sizeof(buf)) > 0)
+        ;
+    fcntl(fd, F_SETFL, flags);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-7] [-d device] [-b messages per batch] [-t seconds per run]\n",
+            prog);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    struct sigaction sa = { .sa_handler = wake_handler };  // no SA_RESTART
+    static const size_t sizes[] = { 8, 64, 256 };
+    double single, batched;
+    unsigned int i;
+    int opt, fd;
+
+    while ((opt = getopt(argc, argv, "7d:b:t:")) != -1) {
+        switch (opt) {
+            case '7':
+                cmd_mode = PCHAR_SET_MSG_MODE;
+                cmd_enq = PCHAR_ENQ_BATCH;
+                cmd_deq = PCHAR_DEQ_BATCH;
+                break;
+            case 'd':
+                dev_path = optarg;
+                break;
+            case 'b':
+                batch_size = atoi(optarg);
+                break;
+            case 't':
+                seconds = atof(optarg);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (!batch_size || batch_size > MAX_BATCH || seconds <= 0)
+        usage(argv[0]);
+    sigaction(SIGUSR1, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    // The framing can only change while we are the sole opener
+    fd = open(dev_path, O_RDWR);
+    if (fd < 0 || ioctl(fd, cmd_mode, 1)) {
+        perror(dev_path);
+        return 1;
+    }
+
+    printf("%8s %14s %14s %8s\n", "size", "single_msg/s", "batch_msg/s", "speedup");
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        single = run(sizes[i], 0);
+        drain(fd);
+        batched = run(sizes[i], batch_size);
+        drain(fd);
+        if (single < 0 || batched < 0)
+            break;
+        printf("%8zu %14.0f %14.0f %8.1f\n", sizes[i], single, batched,
+               single ? batched / single : 0);
+    }
+
+    // Back to a byte stream for whoever uses the device next
+    if (ioctl(fd, cmd_mode, 0))
+        perror("leaving message mode");
+    close(fd);
+    return i < sizeof(sizes) / sizeof(sizes[0]);
+}
@@ -0,0 +1,246 @@
+// Userspace benchmark: pseudo device (hw.c) throughput with the FIFO buffer
+// on the local NUMA node against remote ones.
+//
+// A writer and a reader thread are pinned to the CPUs of node -c and stream
+// -s byte calls through one device. Before each run the FIFO buffer is moved
+// to the next online node with MY_IOCTL_CMD_SET_NODE, so the table has one
+// row per node, local first. On a single node machine, try QEMU with e.g.
+// "-smp 4 -numa node,cpus=0-1 -numa node,cpus=2-3".
+//
+//   insmod hw.ko
+//   make bench && ./bench_numa -d /dev/pseudo0 -c 0
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/types.h>
+
+// From hw.c
+#define MY_IOCTL_CMD_SET_NODE _IOW('M', 11, __s32)  // NUMA node for the FIFO, -1 = opener's
+
+#define MAX_NODES 64
+#define NODE_SYSFS "/sys/devices/system/node"
+
+static const char *dev_path = "/dev/pseudo0";
+static int cpu_node;
+static size_t chunk = 4096;
+static double seconds = 1.0;
+static volatile int stop;
+
+struct worker {
+    pthread_t thread;
+    int writer;
+    cpu_set_t cpus;
+    unsigned long long bytes;
+    int err;
+};
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void wake_handler(int sig)
+{
+    (void)sig;
+}
+
+// Read a sysfs list such as "0-3,8,10-11" and call 'add' for every member
+static int read_list(const char *path, void (*add)(int, void *), void *arg)
+{
+    char line[4096], *p, *end;
+    long a, b;
+    FILE *f = fopen(path, "r");
+
+    if (!f)
+        return -1;
+    if (!fgets(line, sizeof(line), f)) {
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+    for (p = line; *p && *p != '\n'; p = *end ? end + 1 : end) {
+        a = b = strtol(p, &end, 10);
+        if (end == p)
+            return -1;
+        if (*end == '-')
+            b = strtol(end + 1, &end, 10);
+        for (; a <= b; a++)
+            add(a, arg);
+    }
+    return 0;
+}
+
+static void add_cpu(int cpu, void *arg)
+{
+    if (cpu < CPU_SETSIZE)
+        CPU_SET(cpu, (cpu_set_t *)arg);
+}
+
+static void add_node(int node, void *arg)
+{
+    int *nodes = arg;
+
+    if (nodes[0] < MAX_NODES)
+        nodes[++nodes[0]] = node;
+}
+
+static void *worker_fn(void *arg)
+{
+    struct worker *w = arg;
+    char *buf = malloc(chunk);
+    ssize_t n;
+    int fd = -1;
+
+    // Pin first, so the open and every copy happen on the chosen node
+    w->err = pthread_setaffinity_np(pthread_self(), sizeof(w->cpus), &w->cpus);
+    if (w->err)
+        goto out;
+    fd = open(dev_path, w->writer ? O_WRONLY : O_RDONLY);
+    if (fd < 0 || !buf) {
+        w->err = errno;
+        goto out;
+    }
+    memset(buf, 'n', chunk);
+
+    while (!stop) {
+        n = w->writer ? write(fd, buf, chunk) : read(fd, buf, chunk);
+        if (n < 0) {
+            if (errno != EINTR && !stop)
+                w->err = errno;
+            break;
+        }
+        w->bytes += n;
+    }
+out:
+    if (fd >= 0)
+        close(fd);
+    free(buf);
+    return NULL;
+}
+
+// Stream through the device from the CPUs in 'cpus', return MB/s or -1
+static double run(const cpu_set_t *cpus)
+{
+    struct worker workers[2];
+    double start, elapsed;
+    int i, err = 0;
+
+    memset(workers, 0, sizeof(workers));
+    stop = 0;
+    for (i = 0; i < 2; i++) {
+        workers[i].writer = i;
+        workers[i].cpus = *cpus;
+        pthread_create(&workers[i].thread, NULL, worker_fn, &workers[i]);
+    }
+
+    start = now();
+    usleep(seconds * 1e6);
+    stop = 1;
+    elapsed = now() - start;
+
+    for (i = 0; i < 2; i++)
+        pthread_kill(workers[i].thread, SIGUSR1);
+    for (i = 0; i < 2; i++) {
+        pthread_join(workers[i].thread, NULL);
+        if (workers[i].err && !err) {
+            err = workers[i].err;
+            fprintf(stderr, "%s: %s\n", workers[i].writer ? "writer" : "reader", strerror(err));
+        }
+    }
+    return err ? -1 : workers[0].bytes / elapsed / 1e6;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-d device] [-c node to run on] [-s bytes per call] "
+            "[-t seconds per run]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    struct sigaction sa = { .sa_handler = wake_handler };  // no SA_RESTART
+    int nodes[MAX_NODES + 1] = { 0 };  // count, then the online nodes
+    char path[128];
+    cpu_set_t cpus;
+    double local = 0, mbs;
+    int opt, fd, i, node;
+
+    while ((opt = getopt(argc, argv, "d:c:s:t:")) != -1) {
+        switch (opt) {
+            case 'd':
+                dev_path = optarg;
+                break;
+            case 'c':
+                cpu_node = atoi(optarg);
+                break;
+            case 's':
+                chunk = atol(optarg);
+                break;
+            case 't':
+                seconds = atof(optarg);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (cpu_node < 0 || !chunk || seconds <= 0)
+        usage(argv[0]);
+    sigaction(SIGUSR1, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    CPU_ZERO(&cpus);
+    snprintf(path, sizeof(path), NODE_SYSFS "/node%d/cpulist", cpu_node);
+    if (read_list(path, add_cpu, &cpus) || !CPU_COUNT(&cpus)) {
+        fprintf(stderr, "node %d has no CPUs\n", cpu_node);
+        return 1;
+    }
+    if (read_list(NODE_SYSFS "/online", add_node, nodes) || !nodes[0]) {
+        fprintf(stderr, "cannot read " NODE_SYSFS "/online\n");
+        return 1;
+    }
+
+    // The device stays open so the node setting is not lost between runs
+    fd = open(dev_path, O_WRONLY);
+    if (fd < 0) {
+        perror(dev_path);
+        return 1;
+    }
+
+    printf("cpus on node %d (%d), %zu bytes per call\n", cpu_node, CPU_COUNT(&cpus), chunk);
+    printf("%10s %8s %12s %10s\n", "fifo_node", "where", "MB/s", "vs_local");
+    // Local node first, then every other online node
+    for (i = 0; i <= nodes[0]; i++) {
+        node = i ? nodes[i] : cpu_node;
+        if (i && node == cpu_node)
+            continue;
+        if (ioctl(fd, MY_IOCTL_CMD_SET_NODE, node)) {
+            perror("MY_IOCTL_CMD_SET_NODE");
+            return 1;
+        }
+        mbs = run(&cpus);
+        if (mbs < 0)
+            return 1;
+        if (!i)
+            local = mbs;
+        printf("%10d %8s %12.1f %10.2f\n", node, i ? "remote" : "local", mbs,
+               local > 0 ? mbs / local : 0);
+    }
+
+    // Back to following the opener
+    ioctl(fd, MY_IOCTL_CMD_SET_NODE, -1);
+    close(fd);
+    return 0;
+}
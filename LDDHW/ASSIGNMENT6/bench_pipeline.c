@@ -0,0 +1,245 @@
+// Userspace benchmark: chained pseudo devices (hw.c), in-kernel links
+// against a userspace relay.
+//
+// A writer streams into /dev/pseudo0 and a reader drains /dev/pseudoK, with
+// K hops in between, for K = 1, 2, 4, ... up to -n. In "link" mode each hop
+// is a MY_IOCTL_CMD_LINK forwarder inside the driver; in "relay" mode each
+// hop is a thread doing read() then write(), the way a userspace pipeline
+// would. Prints end-to-end MB/s of both and the gain of the links.
+//
+//   insmod hw.ko ndevices=9
+//   make bench && ./bench_pipeline -n 8 -s 65536
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/types.h>
+
+// From hw.c
+#define MY_IOCTL_CMD_LINK _IOW('M', 10, __s32)  // forward output to pseudoN, -1 to unlink
+
+#define MAX_HOPS 64
+
+static const char *dev_prefix = "/dev/pseudo";
+static unsigned int max_hops = 4;
+static size_t chunk = 4096;
+static double seconds = 1.0;
+static volatile int stop;
+
+enum role { WRITER, READER, RELAY };
+
+struct worker {
+    pthread_t thread;
+    enum role role;
+    unsigned int dev;  // device written, read, or relayed from (to dev + 1)
+    unsigned long long bytes;
+    int err;
+};
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void wake_handler(int sig)
+{
+    (void)sig;
+}
+
+static int open_dev(unsigned int dev, int flags)
+{
+    char path[64];
+
+    snprintf(path, sizeof(path), "%s%u", dev_prefix, dev);
+    return open(path, flags);
+}
+
+// Whole buffer or an error; a relay must not drop the tail of a short write
+static int write_all(int fd, const char *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len) {
+        n = write(fd, buf, len);
+        if (n < 0)
+            return -1;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void *worker_fn(void *arg)
+{
+    struct worker *w = arg;
+    char *buf = malloc(chunk);
+    int in = -1, out = -1;
+    ssize_t n = 0;
+
+    if (w->role != WRITER)
+        in = open_dev(w->dev, O_RDONLY);
+    if (w->role != READER)
+        out = open_dev(w->role == RELAY ? w->dev + 1 : w->dev, O_WRONLY);
+    if ((w->role != WRITER && in < 0) || (w->role != READER && out < 0) || !buf) {
+        w->err = errno;
+        goto out;
+    }
+    memset(buf, 'p', chunk);
+
+    while (!stop) {
+        if (w->role != WRITER)
+            n = read(in, buf, chunk);
+        else
+            n = chunk;
+        if (n > 0 && w->role != READER && write_all(out, buf, n))
+            n = -1;
+        if (n < 0) {
+            if (errno != EINTR && !stop)
+                w->err = errno;
+            break;
+        }
+        w->bytes += n;
+    }
+out:
+    if (in >= 0)
+        close(in);
+    if (out >= 0)
+        close(out);
+    free(buf);
+    return NULL;
+}
+
+// Throw away what a run left in a device so the next one starts empty
+static void drain(unsigned int dev)
+{
+    char buf[65536];
+    int fd = open_dev(dev, O_RDONLY | O_NONBLOCK);
+
+    if (fd < 0)
+        return;
+    while (read(fd, buf, sizeof(buf)) > 0)
+        ;
+    close(fd);
+}
+
+// Stream through 'hops' hops, linked in the driver or relayed; returns MB/s
+// at the far end or -1
+static double run(unsigned int hops, int linked)
+{
+    static struct worker workers[MAX_HOPS + 2];
+    int links[MAX_HOPS];
+    unsigned long long bytes = 0;
+    unsigned int i, nworkers = 2;
+    double start, elapsed = 0;
+    int err = 0;
+
+    // The links live as long as the descriptor they were set up through
+    for (i = 0; i < hops; i++)
+        links[i] = -1;
+    for (i = 0; linked && i < hops; i++) {
+        links[i] = open_dev(i, O_WRONLY);
+        if (links[i] < 0 || ioctl(links[i], MY_IOCTL_CMD_LINK, i + 1)) {
+            fprintf(stderr, "link %s%u -> %u: %s\n", dev_prefix, i, i + 1, strerror(errno));
+            err = 1;
+            goto out;
+        }
+    }
+
+    memset(workers, 0, sizeof(workers));
+    stop = 0;
+    workers[0].role = WRITER;
+    workers[0].dev = 0;
+    workers[1].role = READER;
+    workers[1].dev = hops;
+    for (i = 0; !linked && i < hops; i++) {
+        workers[nworkers].role = RELAY;
+        workers[nworkers++].dev = i;
+    }
+    for (i = 0; i < nworkers; i++)
+        pthread_create(&workers[i].thread, NULL, worker_fn, &workers[i]);
+
+    start = now();
+    usleep(seconds * 1e6);
+    stop = 1;
+    elapsed = now() - start;
+
+    for (i = 0; i < nworkers; i++)
+        pthread_kill(workers[i].thread, SIGUSR1);
+    for (i = 0; i < nworkers; i++) {
+        pthread_join(workers[i].thread, NULL);
+        if (workers[i].err && !err) {
+            err = workers[i].err;
+            fprintf(stderr, "%s%u: %s\n", dev_prefix, workers[i].dev, strerror(err));
+        }
+    }
+    bytes = workers[1].bytes;
+
+out:
+    for (i = 0; i < hops; i++)
+        if (links[i] >= 0)
+            close(links[i]);
+    for (i = 0; i <= hops; i++)
+        drain(i);
+    return err ? -1 : bytes / elapsed / 1e6;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-p device prefix] [-n max hops] [-s bytes per call] "
+            "[-t seconds per run]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    struct sigaction sa = { .sa_handler = wake_handler };  // no SA_RESTART
+    double link_mbs, relay_mbs;
+    unsigned int k;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:n:s:t:")) != -1) {
+        switch (opt) {
+            case 'p':
+                dev_prefix = optarg;
+                break;
+            case 'n':
+                max_hops = atoi(optarg);
+                break;
+            case 's':
+                chunk = atol(optarg);
+                break;
+            case 't':
+                seconds = atof(optarg);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (!max_hops || max_hops > MAX_HOPS || !chunk || seconds <= 0)
+        usage(argv[0]);
+    sigaction(SIGUSR1, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("%8s %12s %12s %8s\n", "hops", "link_MB/s", "relay_MB/s", "gain");
+    for (k = 1;; k = k * 2 < max_hops ? k * 2 : max_hops) {
+        link_mbs = run(k, 1);
+        relay_mbs = run(k, 0);
+        if (link_mbs < 0 || relay_mbs < 0)
+            return 1;
+        printf("%8u %12.1f %12.1f %8.2f\n", k, link_mbs, relay_mbs,
+               relay_mbs > 0 ? link_mbs / relay_mbs : 0);
+        if (k == max_hops)
+            break;
+    }
+    return 0;
+}
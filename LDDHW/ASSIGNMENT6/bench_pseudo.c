@@ -0,0 +1,165 @@
+// Userspace scaling benchmark for the pseudo devices (hw.c).
+//
+// Runs one writer and one reader thread on each of k independent devices,
+// /dev/pseudo0 .. /dev/pseudo(k-1), for k = 1, 2, 4, ... up to -n, and prints
+// the aggregate throughput next to k times the single device figure. Devices
+// share no locks, so on enough cores the two columns should stay close.
+//
+//   insmod hw.ko ndevices=16
+//   make bench && ./bench_pseudo -n 16 -s 4096
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_DEVICES 256
+
+static const char *dev_prefix = "/dev/pseudo";
+static unsigned int max_devices = 4;
+static size_t chunk = 4096;
+static double seconds = 1.0;
+static volatile int stop;
+
+struct worker {
+    pthread_t thread;
+    char path[64];
+    int writer;
+    unsigned long long bytes;
+    int err;
+};
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void wake_handler(int sig)
+{
+    (void)sig;
+}
+
+static void *worker_fn(void *arg)
+{
+    struct worker *w = arg;
+    char *buf = malloc(chunk);
+    ssize_t n;
+    int fd;
+
+    fd = open(w->path, w->writer ? O_WRONLY : O_RDONLY);
+    if (fd < 0 || !buf) {
+        w->err = errno;
+        goto out;
+    }
+    memset(buf, 'x', chunk);
+
+    while (!stop) {
+        n = w->writer ? write(fd, buf, chunk) : read(fd, buf, chunk);
+        if (n < 0) {
+            if (errno != EINTR && !stop)
+                w->err = errno;
+            break;
+        }
+        w->bytes += n;
+    }
+out:
+    if (fd >= 0)
+        close(fd);
+    free(buf);
+    return NULL;
+}
+
+// Stream through devices 0..k-1 at once, return aggregate MB/s or -1
+static double run(unsigned int k)
+{
+    static struct worker workers[2 * MAX_DEVICES];
+    unsigned long long bytes = 0;
+    double start, elapsed;
+    unsigned int i;
+    int err = 0;
+
+    memset(workers, 0, sizeof(workers));
+    stop = 0;
+    for (i = 0; i < 2 * k; i++) {
+        snprintf(workers[i].path, sizeof(workers[i].path), "%s%u", dev_prefix, i / 2);
+        workers[i].writer = i & 1;
+        pthread_create(&workers[i].thread, NULL, worker_fn, &workers[i]);
+    }
+
+    start = now();
+    usleep(seconds * 1e6);
+    stop = 1;
+    elapsed = now() - start;
+
+    for (i = 0; i < 2 * k; i++)
+        pthread_kill(workers[i].thread, SIGUSR1);
+    for (i = 0; i < 2 * k; i++) {
+        pthread_join(workers[i].thread, NULL);
+        if (!workers[i].writer)
+            bytes += workers[i].bytes;
+        if (workers[i].err && !err) {
+            err = workers[i].err;
+            fprintf(stderr, "%s: %s\n", workers[i].path, strerror(err));
+        }
+    }
+    return err ? -1 : bytes / elapsed / 1e6;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-p device prefix] [-n devices] [-s bytes per call] "
+            "[-t seconds per step]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    struct sigaction sa = { .sa_handler = wake_handler };  // no SA_RESTART
+    double one = 0, mbs;
+    unsigned int k;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:n:s:t:")) != -1) {
+        switch (opt) {
+            case 'p':
+                dev_prefix = optarg;
+                break;
+            case 'n':
+                max_devices = atoi(optarg);
+                break;
+            case 's':
+                chunk = atol(optarg);
+                break;
+            case 't':
+                seconds = atof(optarg);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (!max_devices || max_devices > MAX_DEVICES || !chunk || seconds <= 0)
+        usage(argv[0]);
+    sigaction(SIGUSR1, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("%8s %12s %12s %12s\n", "devices", "MB/s", "linear_MB/s", "per_device");
+    for (k = 1;; k = k * 2 < max_devices ? k * 2 : max_devices) {
+        mbs = run(k);
+        if (mbs < 0)
+            return 1;
+        if (k == 1)
+            one = mbs;
+        printf("%8u %12.1f %12.1f %12.1f\n", k, mbs, one * k, mbs / k);
+        if (k == max_devices)
+            break;
+    }
+    return 0;
+}
@@ -4,34 +4,303 @@
 #include <linux/uaccess.h>
 #include <linux/module.h>
 #include <linux/init.h>
-#include <linux/kfifo.h>
+#include <linux/vmalloc.h>
 #include <linux/cdev.h>
 #include <linux/device.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/uio.h>
+#include <linux/splice.h>
+#include <linux/workqueue.h>
+#include <linux/log2.h>
+#include <linux/xarray.h>
+#include <linux/miscdevice.h>
+#include <linux/ktime.h>
+#include <linux/percpu.h>
+#include <linux/poll.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/kthread.h>
+#include <linux/math64.h>
+#include <linux/nodemask.h>
+#include <linux/topology.h>
+
+#define CREATE_TRACE_POINTS
+#include "hw_trace.h"
 
 #define DEVICE_NAME "pseudo_char_device"
-#define DEVICE_COUNT 2  // Number of device instances
+#define DEVICE_COUNT 2  // Default number of device instances created at load
+#define PSEUDO_FIFO_SIZE 1024  // FIFO size allocated on first open
+#define PSEUDO_FIFO_MAX INT_MAX  // Largest FIFO, any byte count up to it
+
+// FIFO auto-tuning settings, passed with MY_IOCTL_CMD_AUTOTUNE
+struct fifo_autotune {
+    __u32 enable;    // 0 = fixed size, 1 = grow/shrink from occupancy
+    __u32 min_size;  // bytes, lower limit when shrinking
+    __u32 max_size;  // bytes, upper limit when growing
+};
+
+// Batch of messages for MY_IOCTL_CMD_ENQ_BATCH/DEQ_BATCH. Dequeue stores the
+// length of each received message back into its iov_len.
+struct fifo_msg_batch {
+    __u64 iov;    // user pointer to struct iovec[count]
+    __u32 count;  // messages to move
+    __u32 done;   // out: messages moved
+};
+
+// Queueing delay tracking settings, passed with MY_IOCTL_CMD_SOJOURN
+struct fifo_sojourn_cfg {
+    __u32 enable;       // timestamp writes and keep a sojourn-time histogram
+    __u32 target_us;    // 0 = no target; otherwise flag the producer above it
+    __u32 interval_us;  // how long the delay must stay above target first
+    __u32 reject;       // 1 = writes fail with -ENOBUFS while above target
+};
+
+// Message mode records: 16-bit length header then payload, as kfifo_rec_ptr_2
+#define FIFO_REC_HDR 2
+#define FIFO_REC_MAX 0xffff
 
 // Define the ioctl commands
 #define MY_IOCTL_CMD_RESIZE_FIFO _IOW('M', 1, size_t)
+#define MY_IOCTL_CMD_AUTOTUNE _IOW('M', 2, struct fifo_autotune)
+#define MY_IOCTL_CMD_SET_MSG_MODE _IOW('M', 5, __u32)
+#define MY_IOCTL_CMD_ENQ_BATCH _IOWR('M', 6, struct fifo_msg_batch)
+#define MY_IOCTL_CMD_DEQ_BATCH _IOWR('M', 7, struct fifo_msg_batch)
+#define MY_IOCTL_CMD_SOJOURN _IOW('M', 8, struct fifo_sojourn_cfg)
+#define MY_IOCTL_CMD_BROADCAST _IOW('M', 9, __u32)
+#define MY_IOCTL_CMD_LINK _IOW('M', 10, __s32)  // forward output to pseudoN, -1 to unlink
+#define MY_IOCTL_CMD_SET_NODE _IOW('M', 11, __s32)  // NUMA node for the FIFO, -1 = opener's
+
+// Broadcast policies for MY_IOCTL_CMD_BROADCAST: every reader sees every byte
+#define FIFO_BCAST_OFF 0    // readers share one stream, each byte goes to one of them
+#define FIFO_BCAST_BLOCK 1  // writers wait for the slowest reader
+#define FIFO_BCAST_DROP 2   // writers overwrite the oldest data, lapped readers skip it
+
+// Control device (/dev/pseudo_ctl) commands, the argument is a __u32 index
+#define MY_IOCTL_CMD_CREATE_DEVICE _IOR('M', 3, __u32)
+#define MY_IOCTL_CMD_DESTROY_DEVICE _IOW('M', 4, __u32)
+
+static unsigned int ndevices = DEVICE_COUNT;
+module_param(ndevices, uint, 0444);
+MODULE_PARM_DESC(ndevices, "Number of pseudo devices created at load");
+
+static unsigned int max_devices = 65536;
+module_param(max_devices, uint, 0444);
+MODULE_PARM_DESC(max_devices, "Upper limit on pseudo devices (minor numbers reserved)");
+
+static unsigned int idle_ms = 10000;
+module_param(idle_ms, uint, 0644);
+MODULE_PARM_DESC(idle_ms, "Free an empty FIFO this long after its last close");
+
+// Auto-tuning: sample each device every autotune_ms, shrink after this many idle samples
+#define AUTOTUNE_IDLE_PERIODS 5
+
+static unsigned int autotune_ms = 1000;
+module_param(autotune_ms, uint, 0644);
+MODULE_PARM_DESC(autotune_ms, "FIFO auto-tuning sample period in milliseconds");
+
+/*
+ * FIFO ring of any byte capacity, in a kmalloc'd or vmalloc'd buffer so that
+ * large sizes need no high-order pages. 'in' and 'out' are free-running byte
+ * counts as in kfifo, but since the size need not divide 2^32, each side also
+ * keeps the buffer offset its index points at. The producer owns in/in_off
+ * (wr_lock) and the consumer out/out_off (rd_lock), each on its own cache line.
+ */
+struct pseudo_fifo {
+    unsigned char *data;
+    unsigned int size;  // capacity in bytes, at most PSEUDO_FIFO_MAX
+    unsigned int in ____cacheline_aligned_in_smp;
+    unsigned int in_off;
+    unsigned int out ____cacheline_aligned_in_smp;
+    unsigned int out_off;
+};
+
+static void fifo_init(struct pseudo_fifo *fifo, void *buf, unsigned int size)
+{
+    memset(fifo, 0, sizeof(*fifo));
+    fifo->data = buf;
+    fifo->size = size;
+}
+
+static inline unsigned int fifo_size(struct pseudo_fifo *fifo)
+{
+    return fifo->size;
+}
+
+static inline unsigned int fifo_len(struct pseudo_fifo *fifo)
+{
+    return READ_ONCE(fifo->in) - READ_ONCE(fifo->out);
+}
+
+static inline unsigned int fifo_avail(struct pseudo_fifo *fifo)
+{
+    return fifo->size - fifo_len(fifo);
+}
+
+static inline bool fifo_is_empty(struct pseudo_fifo *fifo)
+{
+    return READ_ONCE(fifo->in) == READ_ONCE(fifo->out);
+}
+
+static inline bool fifo_is_full(struct pseudo_fifo *fifo)
+{
+    return fifo_len(fifo) >= fifo->size;
+}
+
+// Buffer offset 'delta' bytes past offset 'off', delta at most the size
+static inline unsigned int fifo_wrap(struct pseudo_fifo *fifo, unsigned int off,
+                                     unsigned int delta)
+{
+    off += delta;
+    return off >= fifo->size ? off - fifo->size : off;
+}
+
+// Buffer offset of index 'idx', which must lie between 'out' and 'in' (rd_lock held)
+static inline unsigned int fifo_out_off(struct pseudo_fifo *fifo, unsigned int idx)
+{
+    return fifo_wrap(fifo, fifo->out_off, idx - fifo->out);
+}
+
+// Publish 'n' bytes written at in_off (wr_lock held)
+static inline void fifo_advance_in(struct pseudo_fifo *fifo, unsigned int n)
+{
+    fifo->in_off = fifo_wrap(fifo, fifo->in_off, n);
+    smp_store_release(&fifo->in, fifo->in + n);
+}
+
+// Hand 'n' bytes at out_off back to the producer (rd_lock held)
+static inline void fifo_advance_out(struct pseudo_fifo *fifo, unsigned int n)
+{
+    fifo->out_off = fifo_wrap(fifo, fifo->out_off, n);
+    smp_store_release(&fifo->out, fifo->out + n);
+}
+
+// Per-CPU transfer counters of a device, summed by the 'stats' sysfs attribute
+struct pseudo_stats {
+    u64 rd_bytes, wr_bytes;
+    u64 rd_ops, wr_ops;
+    u64 waits;  // times a reader or writer had to sleep
+    u64 fails;  // calls that returned an error other than -EAGAIN
+};
+
+// Enqueue timestamps: one per write, popped once the reader has passed 'end'
+#define FIFO_STAMPS 256     // power of two
+#define SOJOURN_BUCKETS 24  // bucket i counts delays in [2^i, 2^(i+1)) us
+
+struct fifo_stamp {
+    u64 ts;            // ktime_get_ns() at enqueue
+    unsigned int end;  // FIFO 'in' index after the write
+};
+
+// Queueing delay state, allocated while tracking is enabled. The stamp ring
+// is single producer (wr_lock) / single consumer (rd_lock) like the FIFO.
+struct pseudo_sojourn {
+    u64 target_ns, interval_ns;
+    bool reject;
+    u64 above_since;    // when the delay went above target, 0 while below
+    unsigned int head, tail;
+    struct fifo_stamp stamps[FIFO_STAMPS];
+    u64 hist[SOJOURN_BUCKETS];
+};
 
 // FIFO resize function declaration
-int fifo_resize(struct kfifo *fifo, size_t param);
+struct pseudo_device;
+int fifo_resize(struct pseudo_device *dev, size_t param);
+
+// In-kernel forwarder moving bytes from one device's FIFO into another's
+struct pseudo_link {
+    struct pseudo_device *src, *dst;  // dst is pinned and counted as an opener
+    struct task_struct *task;
+    ktime_t start;
+    // Counters, updated by the forwarder only
+    u64 bytes;   // bytes moved
+    u64 moves;   // copy passes
+    u64 stalls;  // times it waited for space in dst
+};
+
+// Per-open state, kept in filp->private_data
+struct pseudo_file {
+    struct pseudo_device *dev;
+    struct pseudo_link *link;  // forwarder set up through this file, stopped on release
+    struct list_head node;  // on dev->readers if opened for reading (rd_lock)
+    unsigned int cursor;    // broadcast: FIFO index of the next byte for this reader
+    u64 dropped;            // broadcast: bytes overwritten before this reader got them
+    pid_t pid;              // opener, to tell readers apart in sysfs
+};
 
 // Device structure to store data related to each device
 struct pseudo_device {
     struct cdev cdev;
-    struct kfifo fifo;  // FIFO for each device instance
+    struct device dev;  // Holds the refcount, freed by pseudo_dev_release
+    unsigned int id;
+    struct mutex lock;     // Open count, settings and FIFO buffer lifetime
+    unsigned int open_count;
+    bool dead;          // Destroyed, waiting for the last opener to leave
+    bool msg_mode;      // FIFO holds length-prefixed records, not a byte stream
+    unsigned int broadcast;     // FIFO_BCAST_*; 'out' then trails the slowest reader
+    int node;           // NUMA node for the FIFO buffer, NUMA_NO_NODE: the opener's
+    struct pseudo_link *link_out;  // forwarder draining this FIFO (lock and pseudo_link_lock)
+    struct pseudo_link *link_in;   // forwarder filling this FIFO (lock and pseudo_link_lock)
+    struct pseudo_stats __percpu *stats;
+    struct dentry *debugfs;
+    struct delayed_work idle_work;  // Frees the FIFO after idle_ms with no openers
+
+    // Auto-tuning state, protected by 'lock' (samples by 'wr_lock')
+    struct delayed_work autotune_work;
+    bool autotune;
+    unsigned int min_size, max_size;
+    unsigned int idle_periods;    // consecutive samples spent under a quarter full
+    unsigned long grows, shrinks; // resize decisions taken so far
+
+    /*
+     * The rest is touched on every transfer, so the two sides get a cache
+     * line each, as do the FIFO's 'in' and 'out' (see struct pseudo_fifo). A side
+     * holds the wait queue it wakes, not the one it sleeps on: a streaming
+     * writer wakes rd_wq after every write, readers only queue on it when
+     * the FIFO runs dry.
+     */
+    struct pseudo_fifo fifo ____cacheline_aligned_in_smp;  // allocated on first open
+    bool fifo_cached;   // FIFO buffer came from fifo_cache rather than kvmalloc
+    struct pseudo_sojourn *sojourn;  // NULL unless tracking; swapped under all locks
+
+    // Consumer side
+    struct mutex rd_lock ____cacheline_aligned_in_smp;  // the FIFO allows one reader at a time
+    wait_queue_head_t wr_wq;    // Writers waiting for space
+    struct list_head readers;   // struct pseudo_file opened for reading (rd_lock)
+    bool over_target;   // queueing delay stayed above target for an interval
+
+    // Producer side
+    struct mutex wr_lock ____cacheline_aligned_in_smp;  // the FIFO allows one writer at a time
+    wait_queue_head_t rd_wq;    // Readers waiting for data
+    unsigned int high_watermark;  // auto-tuning: peak occupancy in the current sample
+    unsigned int stalls;          // auto-tuning: writers that found the FIFO full this sample
+    bool autotune_parked;         // auto-tuning: worker stopped while idle, next write restarts it
 };
 
 // Global variables
 static int major_num;
 static struct class *dev_class;
-static struct pseudo_device *devices[DEVICE_COUNT];  // Array of devices
+static DEFINE_XARRAY_ALLOC(pseudo_xa);  // Live devices by minor number
+static struct kmem_cache *fifo_cache;   // PSEUDO_FIFO_SIZE buffers
+static struct dentry *pseudo_debugfs;   // /sys/kernel/debug/pseudo
+static DEFINE_MUTEX(pseudo_link_lock);  // Creating and removing links, taken before dev->lock
 
 // Forward declarations for the functions
 static int pseudo_open(struct inode *inode, struct file *filp);
 static int pseudo_release(struct inode *inode, struct file *filp);
 static long pseudo_ioctl(struct file *filp, unsigned int cmd, unsigned long arg);
+static ssize_t pseudo_read_iter(struct kiocb *iocb, struct iov_iter *to);
+static ssize_t pseudo_write_iter(struct kiocb *iocb, struct iov_iter *from);
+static int pseudo_autotune_set(struct pseudo_device *dev, bool enable,
+                               unsigned int min_size, unsigned int max_size);
+static long pseudo_msg_batch(struct file *filp, unsigned int cmd, unsigned long arg);
+static void pseudo_unlock_all(struct pseudo_device *dev);
+static int pseudo_sojourn_set(struct pseudo_device *dev, struct fifo_sojourn_cfg *cfg);
+static int pseudo_broadcast_set(struct pseudo_device *dev, unsigned long mode);
+static int pseudo_link_set(struct pseudo_file *pf, long target);
+static int pseudo_unlink(struct pseudo_file *pf);
+static int pseudo_node_set(struct pseudo_device *dev, int node);
+static __poll_t pseudo_poll(struct file *filp, poll_table *wait);
 
 // File operations structure
 static const struct file_operations pseudo_fops = {
@@ -39,23 +308,88 @@ static const struct file_operations pseudo_fops = {
     .open = pseudo_open,
     .release = pseudo_release,
     .unlocked_ioctl = pseudo_ioctl,  // ioctl function
+    .read_iter = pseudo_read_iter,
+    .write_iter = pseudo_write_iter,
+    .poll = pseudo_poll,
+    .splice_read = generic_file_splice_read,   // FIFO -> pipe pages
+    .splice_write = iter_file_splice_write,    // pipe pages -> FIFO
 };
 
+// Device an open file refers to
+static struct pseudo_device *pseudo_file_dev(struct file *filp)
+{
+    struct pseudo_file *pf = filp->private_data;
+
+    return pf->dev;
+}
+
 // IOCTL function to handle resizing FIFO
 static long pseudo_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 {
-    struct pseudo_device *dev = filp->private_data;
+    struct pseudo_device *dev = pseudo_file_dev(filp);
     int result = 0;
 
     switch (cmd) {
         case MY_IOCTL_CMD_RESIZE_FIFO:
             // Resize the FIFO using the parameter passed from user-space
-            result = fifo_resize(&dev->fifo, (size_t)arg);
+            result = fifo_resize(dev, (size_t)arg);
             if (result < 0) {
                 pr_err("Failed to resize FIFO\n");
             }
             break;
 
+        case MY_IOCTL_CMD_AUTOTUNE: {
+            struct fifo_autotune at;
+
+            if (copy_from_user(&at, (void __user *)arg, sizeof(at)))
+                return -EFAULT;
+            result = pseudo_autotune_set(dev, at.enable, at.min_size, at.max_size);
+            break;
+        }
+
+        case MY_IOCTL_CMD_SET_MSG_MODE:
+            // Only switch framing while nobody else uses the device and nothing is queued
+            mutex_lock(&dev->lock);
+            mutex_lock(&dev->rd_lock);
+            mutex_lock(&dev->wr_lock);
+            if (dev->open_count > 1 || !fifo_is_empty(&dev->fifo) ||
+                dev->link_out || dev->link_in)
+                result = -EBUSY;
+            else if (arg && dev->broadcast)
+                result = -EINVAL;
+            else
+                dev->msg_mode = !!arg;
+            pseudo_unlock_all(dev);
+            break;
+
+        case MY_IOCTL_CMD_BROADCAST:
+            result = pseudo_broadcast_set(dev, arg);
+            break;
+
+        case MY_IOCTL_CMD_LINK:
+            if ((__s32)arg < 0)
+                result = pseudo_unlink(filp->private_data);
+            else
+                result = pseudo_link_set(filp->private_data, (__s32)arg);
+            break;
+
+        case MY_IOCTL_CMD_SET_NODE:
+            result = pseudo_node_set(dev, (__s32)arg);
+            break;
+
+        case MY_IOCTL_CMD_ENQ_BATCH:
+        case MY_IOCTL_CMD_DEQ_BATCH:
+            return pseudo_msg_batch(filp, cmd, arg);
+
+        case MY_IOCTL_CMD_SOJOURN: {
+            struct fifo_sojourn_cfg cfg;
+
+            if (copy_from_user(&cfg, (void __user *)arg, sizeof(cfg)))
+                return -EFAULT;
+            result = pseudo_sojourn_set(dev, &cfg);
+            break;
+        }
+
         default:
             pr_err("Invalid ioctl command\n");
             return -ENOTTY;
@@ -64,50 +398,1107 @@ static long pseudo_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
     return result;
 }
 
-// FIFO resize function implementation
-int fifo_resize(struct kfifo *fifo, size_t param)
+// Auto-tuning worker: grow on producer stalls, shrink after sustained idleness
+static void pseudo_autotune_work(struct work_struct *work)
+{
+    struct pseudo_device *dev = container_of(to_delayed_work(work),
+                                             struct pseudo_device, autotune_work);
+    unsigned int size, target = 0;
+
+    mutex_lock(&dev->lock);
+    if (!dev->autotune) {
+        mutex_unlock(&dev->lock);
+        return;
+    }
+    mutex_lock(&dev->wr_lock);
+    if (!dev->fifo.data) {
+        // Nobody has it open: nothing to tune until a write after the next open
+        dev->autotune_parked = true;
+        mutex_unlock(&dev->wr_lock);
+        mutex_unlock(&dev->lock);
+        return;
+    }
+
+    size = fifo_size(&dev->fifo);
+    if (dev->stalls && size < dev->max_size) {
+        // Writers had to wait: double, within the limit
+        target = min(size * 2, dev->max_size);
+        dev->idle_periods = 0;
+    } else if (dev->high_watermark <= size / 4 && size > dev->min_size) {
+        // Shrink to twice the peak once it stayed low for a while
+        if (++dev->idle_periods >= AUTOTUNE_IDLE_PERIODS) {
+            target = max3(dev->min_size, size / 2,
+                          (unsigned int)roundup_pow_of_two(max(dev->high_watermark, 1U) * 2));
+            if (target >= size)
+                target = 0;
+            dev->idle_periods = 0;
+        }
+    } else {
+        dev->idle_periods = 0;
+    }
+
+    // Nothing written all sample and nothing left to shrink: stop sampling
+    // until the next write rather than waking up every period
+    if (!target && !dev->stalls && !dev->high_watermark && size <= dev->min_size)
+        dev->autotune_parked = true;
+
+    // Start a new sample from the current occupancy
+    dev->high_watermark = fifo_len(&dev->fifo);
+    dev->stalls = 0;
+    mutex_unlock(&dev->wr_lock);
+    mutex_unlock(&dev->lock);
+
+    if (target && !fifo_resize(dev, target)) {
+        mutex_lock(&dev->lock);
+        if (target > size)
+            dev->grows++;
+        else
+            dev->shrinks++;
+        mutex_unlock(&dev->lock);
+    }
+
+    if (!READ_ONCE(dev->autotune_parked))
+        schedule_delayed_work(&dev->autotune_work, msecs_to_jiffies(autotune_ms));
+}
+
+// Account a write for auto-tuning, under wr_lock; restarts a parked worker
+static void pseudo_autotune_note(struct pseudo_device *dev, unsigned int queued)
+{
+    dev->high_watermark = max(dev->high_watermark, queued);
+    if (unlikely(dev->autotune_parked)) {
+        dev->autotune_parked = false;
+        schedule_delayed_work(&dev->autotune_work, msecs_to_jiffies(autotune_ms));
+    }
+}
+
+// Change the auto-tuning settings of a device (ioctl and sysfs)
+static int pseudo_autotune_set(struct pseudo_device *dev, bool enable,
+                               unsigned int min_size, unsigned int max_size)
 {
-    void *temp_array;
-    size_t fifo_size;
+    bool was_enabled;
 
-    // Step 1: Allocate a temporary array to store FIFO contents
-    fifo_size = kfifo_size(fifo);
-    temp_array = kmalloc(fifo_size, GFP_KERNEL);
-    if (!temp_array) {
-        pr_err("Failed to allocate memory for temp array\n");
+    if (min_size < 2 || min_size > max_size || max_size > PSEUDO_FIFO_MAX)
+        return -EINVAL;
+
+    mutex_lock(&dev->lock);
+    if (dev->dead) {
+        mutex_unlock(&dev->lock);
+        return -ENODEV;
+    }
+    was_enabled = dev->autotune;
+    dev->autotune = enable;
+    dev->min_size = min_size;
+    dev->max_size = max_size;
+    mutex_unlock(&dev->lock);
+
+    if (enable && !was_enabled)
+        schedule_delayed_work(&dev->autotune_work, msecs_to_jiffies(autotune_ms));
+    else if (!enable && was_enabled)
+        cancel_delayed_work_sync(&dev->autotune_work);
+
+    return 0;
+}
+
+// Release a FIFO buffer to wherever it came from
+static void pseudo_buf_free(void *data, bool cached)
+{
+    if (cached)
+        kmem_cache_free(fifo_cache, data);
+    else
+        kvfree(data);
+}
+
+// NUMA node a FIFO buffer lives on
+static int pseudo_buf_node(void *data)
+{
+    if (is_vmalloc_addr(data))
+        return page_to_nid(vmalloc_to_page(data));
+    return page_to_nid(virt_to_page(data));
+}
+
+// NUMA node for a new FIFO buffer: the configured one, else where the current
+// buffer lives, else that of the CPU opening the device (lock held)
+static int pseudo_fifo_node(struct pseudo_device *dev)
+{
+    if (dev->node != NUMA_NO_NODE)
+        return dev->node;
+    if (dev->fifo.data)
+        return pseudo_buf_node(dev->fifo.data);
+    return numa_node_id();
+}
+
+// Give the device its default FIFO from fifo_cache if it has none (lock held)
+static int pseudo_fifo_get(struct pseudo_device *dev)
+{
+    void *buf;
+
+    if (dev->fifo.data)
+        return 0;
+
+    buf = kmem_cache_alloc_node(fifo_cache, GFP_KERNEL, pseudo_fifo_node(dev));
+    if (!buf)
         return -ENOMEM;
+    fifo_init(&dev->fifo, buf, PSEUDO_FIFO_SIZE);
+    dev->fifo_cached = true;
+    return 0;
+}
+
+// Drop the device's FIFO buffer (lock held)
+static void pseudo_fifo_put(struct pseudo_device *dev)
+{
+    pseudo_buf_free(dev->fifo.data, dev->fifo_cached);
+    memset(&dev->fifo, 0, sizeof(dev->fifo));
+    dev->fifo_cached = false;
+}
+
+// Idle worker: free the FIFO of a device nobody has open, unless data is queued
+static void pseudo_idle_work(struct work_struct *work)
+{
+    struct pseudo_device *dev = container_of(to_delayed_work(work),
+                                             struct pseudo_device, idle_work);
+
+    mutex_lock(&dev->lock);
+    if (!dev->open_count && dev->fifo.data && fifo_is_empty(&dev->fifo))
+        pseudo_fifo_put(dev);
+    mutex_unlock(&dev->lock);
+}
+
+// Stamp a write that moved the FIFO 'in' index (wr_lock held)
+static void pseudo_stamp(struct pseudo_device *dev)
+{
+    struct pseudo_sojourn *sj = dev->sojourn;
+    unsigned int head;
+
+    if (!sj)
+        return;
+
+    head = sj->head;
+    if (head - smp_load_acquire(&sj->tail) == FIFO_STAMPS) {
+        // Ring full: fold into the newest stamp, keeping its older time
+        WRITE_ONCE(sj->stamps[(head - 1) % FIFO_STAMPS].end, dev->fifo.in);
+        return;
+    }
+    sj->stamps[head % FIFO_STAMPS].ts = ktime_get_ns();
+    sj->stamps[head % FIFO_STAMPS].end = dev->fifo.in;
+    smp_store_release(&sj->head, head + 1);
+}
+
+// After a read moved 'out': record the delay of every write now fully consumed
+// and update the target-delay state (rd_lock held)
+static void pseudo_sojourn_account(struct pseudo_device *dev)
+{
+    struct pseudo_sojourn *sj = dev->sojourn;
+    unsigned int out, tail, head;
+    u64 now, delay = 0;
+
+    if (!sj)
+        return;
+
+    now = ktime_get_ns();
+    out = dev->fifo.out;
+    tail = sj->tail;
+    head = smp_load_acquire(&sj->head);
+    while (tail != head) {
+        struct fifo_stamp *st = &sj->stamps[tail % FIFO_STAMPS];
+
+        if ((int)(READ_ONCE(st->end) - out) > 0)
+            break;
+        delay = now - st->ts;
+        sj->hist[min_t(unsigned int, ilog2(max_t(u64, delay / NSEC_PER_USEC, 1)),
+                       SOJOURN_BUCKETS - 1)]++;
+        tail++;
+    }
+    smp_store_release(&sj->tail, tail);
+
+    // CoDel-style: only a delay that stays above target for an interval counts
+    if (fifo_is_empty(&dev->fifo) || !sj->target_ns || (delay && delay <= sj->target_ns)) {
+        sj->above_since = 0;
+        WRITE_ONCE(dev->over_target, false);
+    } else if (delay) {
+        if (!sj->above_since)
+            sj->above_since = now;
+        else if (now - sj->above_since >= sj->interval_ns)
+            WRITE_ONCE(dev->over_target, true);
+    }
+}
+
+// Shift pending stamps to FIFO indices counted from 'base' (all locks held)
+static void pseudo_stamps_rebase(struct pseudo_device *dev, unsigned int base)
+{
+    struct pseudo_sojourn *sj = dev->sojourn;
+    unsigned int i;
+
+    if (!sj)
+        return;
+    for (i = sj->tail; i != sj->head; i++)
+        sj->stamps[i % FIFO_STAMPS].end -= base;
+}
+
+// Whether the producer should be told to back off
+static bool pseudo_over_target(struct pseudo_device *dev)
+{
+    return READ_ONCE(dev->over_target);
+}
+
+// Enable, reconfigure or disable queueing delay tracking
+static int pseudo_sojourn_set(struct pseudo_device *dev, struct fifo_sojourn_cfg *cfg)
+{
+    struct pseudo_sojourn *sj = NULL, *old = NULL;
+
+    if (cfg->enable) {
+        sj = kzalloc(sizeof(*sj), GFP_KERNEL);
+        if (!sj)
+            return -ENOMEM;
+        sj->target_ns = (u64)cfg->target_us * NSEC_PER_USEC;
+        sj->interval_ns = (u64)cfg->interval_us * NSEC_PER_USEC;
+        sj->reject = cfg->reject;
+    }
+
+    mutex_lock(&dev->lock);
+    mutex_lock(&dev->rd_lock);
+    mutex_lock(&dev->wr_lock);
+    if (sj && dev->sojourn) {
+        // Keep the histogram and pending stamps, only take the new settings
+        dev->sojourn->target_ns = sj->target_ns;
+        dev->sojourn->interval_ns = sj->interval_ns;
+        dev->sojourn->reject = sj->reject;
+        old = sj;
+    } else {
+        // Bytes already queued when tracking starts are not stamped
+        old = dev->sojourn;
+        dev->sojourn = sj;
+        dev->over_target = false;
+    }
+    pseudo_unlock_all(dev);
+
+    kfree(old);
+    wake_up_interruptible(&dev->wr_wq);
+    return 0;
+}
+
+// Broadcast: move 'out' up to the slowest reader's cursor, freeing what every
+// reader has seen. A lapped reader resumes at 'out', so it holds back nothing
+// beyond it. With no reader left the data stays for the next one (rd_lock held).
+static void pseudo_bcast_advance(struct pseudo_device *dev)
+{
+    unsigned int out = dev->fifo.out;
+    unsigned int min = smp_load_acquire(&dev->fifo.in) - out;
+    struct pseudo_file *pf;
+
+    if (list_empty(&dev->readers))
+        return;
+    list_for_each_entry(pf, &dev->readers, node) {
+        if ((int)(pf->cursor - out) <= 0)
+            return;
+        min = min(min, pf->cursor - out);
     }
 
-    // Step 2: Copy FIFO contents into the temporary array
-    if (kfifo_out(fifo, temp_array, fifo_size) != fifo_size) {
-        pr_err("Failed to read all contents from FIFO\n");
-        kfree(temp_array);
-        return -EIO;
+    fifo_advance_out(&dev->fifo, min);
+}
+
+// Shift reader cursors to FIFO indices counted from 'base' (all locks held)
+static void pseudo_cursors_rebase(struct pseudo_device *dev, unsigned int base)
+{
+    struct pseudo_file *pf;
+
+    list_for_each_entry(pf, &dev->readers, node)
+        pf->cursor -= base;
+}
+
+// Change the broadcast policy. Readers may already be open; turning broadcast
+// on or off needs an empty FIFO so that every cursor starts at the same place.
+static int pseudo_broadcast_set(struct pseudo_device *dev, unsigned long mode)
+{
+    struct pseudo_file *pf;
+    int ret = 0;
+
+    if (mode > FIFO_BCAST_DROP)
+        return -EINVAL;
+
+    mutex_lock(&dev->lock);
+    mutex_lock(&dev->rd_lock);
+    mutex_lock(&dev->wr_lock);
+    if (mode && dev->msg_mode) {
+        ret = -EINVAL;
+    } else if (mode && (dev->link_out || dev->link_in)) {
+        ret = -EBUSY;
+    } else if (!mode != !dev->broadcast) {
+        if (!fifo_is_empty(&dev->fifo)) {
+            ret = -EBUSY;
+        } else {
+            list_for_each_entry(pf, &dev->readers, node)
+                pf->cursor = dev->fifo.out;
+            dev->broadcast = mode;
+        }
+    } else {
+        // Only the policy for slow readers changes, cursors stay valid
+        dev->broadcast = mode;
+    }
+    pseudo_unlock_all(dev);
+
+    // Writers blocked on a slow reader may now overwrite instead
+    wake_up_interruptible(&dev->wr_wq);
+    return ret;
+}
+
+// Place the FIFO buffer on a NUMA node (NUMA_NO_NODE: follow the opener) and
+// move a live buffer there, keeping its size and contents
+static int pseudo_node_set(struct pseudo_device *dev, int node)
+{
+    unsigned int size = 0;
+
+    if (node != NUMA_NO_NODE && (node < 0 || node >= MAX_NUMNODES || !node_online(node)))
+        return -EINVAL;
+
+    mutex_lock(&dev->lock);
+    dev->node = node;
+    if (node != NUMA_NO_NODE && dev->fifo.data &&
+        pseudo_buf_node(dev->fifo.data) != node)
+        size = fifo_size(&dev->fifo);
+    mutex_unlock(&dev->lock);
+
+    return size ? fifo_resize(dev, size) : 0;
+}
+
+// Drop the three locks fifo_resize takes
+static void pseudo_unlock_all(struct pseudo_device *dev)
+{
+    mutex_unlock(&dev->wr_lock);
+    mutex_unlock(&dev->rd_lock);
+    mutex_unlock(&dev->lock);
+}
+
+// Copy the first 'len' queued bytes out to 'buf' without consuming them
+static void fifo_peek(struct pseudo_fifo *fifo, void *buf, unsigned int len)
+{
+    unsigned int l = min(len, fifo->size - fifo->out_off);
+
+    memcpy(buf, fifo->data + fifo->out_off, l);
+    memcpy(buf + l, fifo->data, len - l);
+}
+
+// Move queued bytes from 'src' straight into free space of 'dst', as far as both
+// allow. Caller holds the consumer side of src and the producer side of dst.
+static unsigned int fifo_move(struct pseudo_fifo *dst, struct pseudo_fifo *src)
+{
+    unsigned int n = min(fifo_len(src), fifo_avail(dst));
+    unsigned int soff = src->out_off, doff = dst->in_off;
+    unsigned int done, l;
+
+    // At most three segments: either ring may wrap, at different points
+    for (done = 0; done < n; done += l) {
+        l = min3(n - done, src->size - soff, dst->size - doff);
+        memcpy(dst->data + doff, src->data + soff, l);
+        soff = fifo_wrap(src, soff, l);
+        doff = fifo_wrap(dst, doff, l);
     }
 
-    // Step 3: Release FIFO memory
-    kfifo_free(fifo);
+    fifo_advance_in(dst, n);
+    fifo_advance_out(src, n);
+    return n;
+}
+
+// FIFO resize function implementation: readers and writers only wait for the
+// copy of the queued bytes, the allocation and free happen outside the locks
+int fifo_resize(struct pseudo_device *dev, size_t param)
+{
+    struct pseudo_fifo new_fifo, old_fifo;
+    bool old_cached;
+    unsigned int len;
+    void *buf;
+    int node;
 
-    // Step 4: Allocate new memory for the FIFO with the new size 'param'
-    if (kfifo_alloc(fifo, param, GFP_KERNEL)) {
+    // Step 1: Allocate the new FIFO first, the old one stays untouched on failure.
+    // Any byte count works; large ones fall back to vmalloc instead of failing.
+    if (param < 2 || param > PSEUDO_FIFO_MAX)
+        return -EINVAL;
+    mutex_lock(&dev->lock);
+    node = pseudo_fifo_node(dev);
+    mutex_unlock(&dev->lock);
+    buf = kvmalloc_node(param, GFP_KERNEL, node);
+    if (!buf) {
         pr_err("Failed to allocate new FIFO memory\n");
-        kfree(temp_array);
         return -ENOMEM;
     }
+    fifo_init(&new_fifo, buf, param);
+
+    // Lock order: lock, rd_lock, wr_lock
+    mutex_lock(&dev->lock);
+    mutex_lock(&dev->rd_lock);
+    mutex_lock(&dev->wr_lock);
+
+    // The idle worker may have released the FIFO meanwhile
+    if (!dev->fifo.data) {
+        pseudo_unlock_all(dev);
+        kvfree(buf);
+        return -ENODEV;
+    }
+
+    // Step 2: Refuse to shrink below what is queued, so no data is ever dropped
+    len = fifo_len(&dev->fifo);
+    if (len > fifo_size(&new_fifo)) {
+        pseudo_unlock_all(dev);
+        pr_err("FIFO holds %u bytes, more than the new size\n", len);
+        kvfree(buf);
+        return -ENOSPC;
+    }
+
+    // Enqueue stamps and reader cursors refer to the old indices; the new FIFO
+    // starts at out = 0
+    pseudo_stamps_rebase(dev, dev->fifo.out);
+    pseudo_cursors_rebase(dev, dev->fifo.out);
+
+    // Step 3: Move only the queued bytes straight into the new buffer
+    fifo_peek(&dev->fifo, new_fifo.data, len);
+    new_fifo.in = len;
+    new_fifo.in_off = fifo_wrap(&new_fifo, 0, len);
+
+    // Step 4: Swap in the new FIFO
+    old_fifo = dev->fifo;
+    old_cached = dev->fifo_cached;
+    dev->fifo = new_fifo;
+    dev->fifo_cached = false;
+    pseudo_unlock_all(dev);
+
+    // Step 5: Release the old buffer, nobody can reach it any more
+    pseudo_buf_free(old_fifo.data, old_cached);
+
+    trace_pseudo_resize(dev->id, fifo_size(&old_fifo), fifo_size(&new_fifo));
+    // Writers waiting for space, or for a record that no longer fits, recheck
+    wake_up_interruptible(&dev->wr_wq);
+
+    return 0;
+}
+
+// Copy 'len' bytes starting at buffer offset 'off' into 'to', one copy per segment
+static size_t fifo_ring_to_iter(struct pseudo_fifo *fifo, unsigned int off,
+                                struct iov_iter *to, size_t len)
+{
+    size_t l = min_t(size_t, len, fifo->size - off);
+    size_t copied;
+
+    copied = copy_to_iter(fifo->data + off, l, to);
+    if (copied == l && len > l)
+        copied += copy_to_iter(fifo->data, len - l, to);
+    return copied;
+}
+
+// Copy 'len' bytes from 'from' to buffer offset 'off', one copy per segment
+static size_t fifo_ring_from_iter(struct pseudo_fifo *fifo, unsigned int off,
+                                  struct iov_iter *from, size_t len)
+{
+    size_t l = min_t(size_t, len, fifo->size - off);
+    size_t copied;
+
+    copied = copy_from_iter(fifo->data + off, l, from);
+    if (copied == l && len > l)
+        copied += copy_from_iter(fifo->data, len - l, from);
+    return copied;
+}
+
+// Copy up to 'len' queued bytes into 'to'
+static size_t fifo_to_iter(struct pseudo_fifo *fifo, struct iov_iter *to, size_t len)
+{
+    size_t copied;
+
+    len = min_t(size_t, len, fifo_len(fifo));
+    copied = fifo_ring_to_iter(fifo, fifo->out_off, to, len);
+    fifo_advance_out(fifo, copied);
+    return copied;
+}
+
+// Copy up to 'len' bytes from 'from' into free FIFO space
+static size_t fifo_from_iter(struct pseudo_fifo *fifo, struct iov_iter *from, size_t len)
+{
+    size_t copied;
+
+    len = min_t(size_t, len, fifo_avail(fifo));
+    copied = fifo_ring_from_iter(fifo, fifo->in_off, from, len);
+    fifo_advance_in(fifo, copied);
+    return copied;
+}
+
+// Length of the record at the head of a message mode FIFO
+static unsigned int fifo_rec_len(struct pseudo_fifo *fifo)
+{
+    return fifo->data[fifo->out_off] | fifo->data[fifo_wrap(fifo, fifo->out_off, 1)] << 8;
+}
+
+// Queue 'len' bytes from 'from' as one record; the caller checked that it fits.
+// Header and payload are published together, so readers never see half a record.
+static int fifo_rec_from_iter(struct pseudo_fifo *fifo, struct iov_iter *from, size_t len)
+{
+    unsigned int off = fifo->in_off;
+
+    if (fifo_ring_from_iter(fifo, fifo_wrap(fifo, off, FIFO_REC_HDR), from, len) != len)
+        return -EFAULT;
+    fifo->data[off] = len & 0xff;
+    fifo->data[fifo_wrap(fifo, off, 1)] = len >> 8;
+
+    fifo_advance_in(fifo, len + FIFO_REC_HDR);
+    return 0;
+}
+
+// Dequeue the next record into 'to', truncated to 'len' bytes like kfifo_rec_out.
+// A fault leaves the record queued.
+static ssize_t fifo_rec_to_iter(struct pseudo_fifo *fifo, struct iov_iter *to, size_t len)
+{
+    unsigned int n = fifo_rec_len(fifo);
+
+    len = min_t(size_t, len, n);
+    if (fifo_ring_to_iter(fifo, fifo_wrap(fifo, fifo->out_off, FIFO_REC_HDR), to, len) != len)
+        return -EFAULT;
+
+    fifo_advance_out(fifo, n + FIFO_REC_HDR);
+    return len;
+}
+
+// Take rd_lock or wr_lock; an IOCB_NOWAIT caller (io_uring) must not sleep
+// on the lock either and gets -EAGAIN instead
+static int pseudo_lock(struct mutex *lock, struct kiocb *iocb)
+{
+    if (iocb->ki_flags & IOCB_NOWAIT)
+        return mutex_trylock(lock) ? 0 : -EAGAIN;
+    return mutex_lock_interruptible(lock) ? -ERESTARTSYS : 0;
+}
+
+// Whether a reader has data waiting: past its own cursor in broadcast mode
+static bool pseudo_readable(struct pseudo_file *pf)
+{
+    struct pseudo_device *dev = pf->dev;
+
+    if (READ_ONCE(dev->broadcast))
+        return READ_ONCE(pf->cursor) != smp_load_acquire(&dev->fifo.in);
+    return !fifo_is_empty(&dev->fifo);
+}
+
+// Broadcast read: copy from the reader's own cursor, then free what all
+// readers have seen (rd_lock held)
+static size_t pseudo_bcast_to_iter(struct pseudo_file *pf, struct iov_iter *to, size_t len)
+{
+    struct pseudo_device *dev = pf->dev;
+    unsigned int out = dev->fifo.out;
+    size_t copied;
+
+    // A lossy writer overwrote bytes this reader had not got to yet
+    if ((int)(out - pf->cursor) > 0) {
+        pf->dropped += out - pf->cursor;
+        pf->cursor = out;
+    }
+
+    len = min_t(size_t, len, smp_load_acquire(&dev->fifo.in) - pf->cursor);
+    copied = fifo_ring_to_iter(&dev->fifo, fifo_out_off(&dev->fifo, pf->cursor), to, len);
+    pf->cursor += copied;
+    pseudo_bcast_advance(dev);
+    return copied;
+}
+
+// Read from the FIFO, blocking while it is empty
+static ssize_t pseudo_do_read(struct kiocb *iocb, struct iov_iter *to)
+{
+    struct pseudo_file *pf = iocb->ki_filp->private_data;
+    struct pseudo_device *dev = pf->dev;
+    bool nonblock = (iocb->ki_filp->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT);
+    ssize_t copied;
+    unsigned int queued;
+    int ret;
+
+    // A zero-length read still consumes one (possibly empty) message
+    if (!iov_iter_count(to) && !dev->msg_mode)
+        return 0;
+
+    ret = pseudo_lock(&dev->rd_lock, iocb);
+    if (ret)
+        return ret;
+
+    // Only readers serialize among themselves; the FIFO lets the one reader run
+    // alongside the one writer without a shared lock
+    while (!pseudo_readable(pf)) {
+        mutex_unlock(&dev->rd_lock);
+        if (nonblock)
+            return -EAGAIN;
+        this_cpu_inc(dev->stats->waits);
+        trace_pseudo_wait(dev->id, false);
+        if (wait_event_interruptible(dev->rd_wq, pseudo_readable(pf)))
+            return -ERESTARTSYS;
+        trace_pseudo_wake(dev->id, false);
+        ret = pseudo_lock(&dev->rd_lock, iocb);
+        if (ret)
+            return ret;
+    }
+
+    if (dev->msg_mode) {
+        copied = fifo_rec_to_iter(&dev->fifo, to, iov_iter_count(to));
+    } else {
+        if (dev->broadcast)
+            copied = pseudo_bcast_to_iter(pf, to, iov_iter_count(to));
+        else
+            copied = fifo_to_iter(&dev->fifo, to, iov_iter_count(to));
+        if (!copied)
+            copied = -EFAULT;
+    }
+    if (copied >= 0)
+        pseudo_sojourn_account(dev);
+    queued = fifo_len(&dev->fifo);
+    mutex_unlock(&dev->rd_lock);
+
+    if (copied < 0)
+        return copied;
+
+    trace_pseudo_dequeue(dev->id, copied, queued);
+    wake_up_interruptible(&dev->wr_wq);
+    return copied;
+}
+
+// Message mode write: queue the whole buffer as one record or nothing
+static ssize_t pseudo_write_msg(struct kiocb *iocb, bool nonblock,
+                                struct iov_iter *from, size_t count)
+{
+    struct pseudo_device *dev = pseudo_file_dev(iocb->ki_filp);
+    size_t need = count + FIFO_REC_HDR;
+    unsigned int queued;
+    int ret;
+
+    if (count > FIFO_REC_MAX)
+        return -EMSGSIZE;
+
+    for (;;) {
+        ret = pseudo_lock(&dev->wr_lock, iocb);
+        if (ret)
+            return ret;
+        if (need > fifo_size(&dev->fifo)) {
+            mutex_unlock(&dev->wr_lock);
+            return -EMSGSIZE;
+        }
+        if (dev->sojourn && dev->sojourn->reject && pseudo_over_target(dev)) {
+            mutex_unlock(&dev->wr_lock);
+            return -ENOBUFS;
+        }
+        if (fifo_avail(&dev->fifo) >= need)
+            break;
+
+        dev->stalls++;
+        mutex_unlock(&dev->wr_lock);
+        if (nonblock)
+            return -EAGAIN;
+        this_cpu_inc(dev->stats->waits);
+        trace_pseudo_wait(dev->id, true);
+        // A shrink below the record size must wake us for the -EMSGSIZE above
+        if (wait_event_interruptible(dev->wr_wq, fifo_avail(&dev->fifo) >= need ||
+                                                 need > fifo_size(&dev->fifo)))
+            return -ERESTARTSYS;
+        trace_pseudo_wake(dev->id, true);
+    }
+
+    ret = fifo_rec_from_iter(&dev->fifo, from, count);
+    if (!ret)
+        pseudo_stamp(dev);
+    queued = fifo_len(&dev->fifo);
+    pseudo_autotune_note(dev, queued);
+    mutex_unlock(&dev->wr_lock);
+    if (ret)
+        return ret;
+
+    trace_pseudo_enqueue(dev->id, count, queued);
+    wake_up_interruptible(&dev->rd_wq);
+    return count;
+}
+
+// Lossy broadcast write: never wait for a slow reader, overwrite the oldest
+// bytes instead. Moving 'out' races with readers, so this takes rd_lock too.
+static ssize_t pseudo_write_lossy(struct kiocb *iocb, struct iov_iter *from, size_t count)
+{
+    struct pseudo_device *dev = pseudo_file_dev(iocb->ki_filp);
+    size_t written = 0;
+    size_t len, copied;
+    unsigned int avail, queued;
+    int ret = 0;
+
+    while (written < count) {
+        ret = pseudo_lock(&dev->rd_lock, iocb);
+        if (ret)
+            break;
+        ret = pseudo_lock(&dev->wr_lock, iocb);
+        if (ret) {
+            mutex_unlock(&dev->rd_lock);
+            break;
+        }
+
+        if (dev->sojourn && dev->sojourn->reject && pseudo_over_target(dev)) {
+            mutex_unlock(&dev->wr_lock);
+            mutex_unlock(&dev->rd_lock);
+            ret = -ENOBUFS;
+            break;
+        }
+
+        len = min_t(size_t, count - written, fifo_size(&dev->fifo));
+        avail = fifo_avail(&dev->fifo);
+        if (len > avail) {
+            // Readers still before the new 'out' see the gap as dropped bytes
+            fifo_advance_out(&dev->fifo, len - avail);
+            dev->stalls++;
+            pseudo_sojourn_account(dev);
+        }
+
+        copied = fifo_from_iter(&dev->fifo, from, len);
+        if (copied)
+            pseudo_stamp(dev);
+        queued = fifo_len(&dev->fifo);
+        pseudo_autotune_note(dev, queued);
+        mutex_unlock(&dev->wr_lock);
+        mutex_unlock(&dev->rd_lock);
+        if (!copied) {
+            ret = -EFAULT;
+            break;
+        }
+        written += copied;
+        trace_pseudo_enqueue(dev->id, copied, queued);
+        wake_up_interruptible(&dev->rd_wq);
+    }
+
+    return written ? written : ret;
+}
+
+// Write to the FIFO, blocking while it is full
+static ssize_t pseudo_do_write(struct kiocb *iocb, struct iov_iter *from)
+{
+    struct pseudo_device *dev = pseudo_file_dev(iocb->ki_filp);
+    bool nonblock = (iocb->ki_filp->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT);
+    size_t count = iov_iter_count(from);
+    size_t written = 0;
+    size_t copied;
+    unsigned int queued;
+    int ret = 0;
+
+    if (dev->msg_mode)
+        return pseudo_write_msg(iocb, nonblock, from, count);
+    if (READ_ONCE(dev->broadcast) == FIFO_BCAST_DROP)
+        return pseudo_write_lossy(iocb, from, count);
+
+    while (written < count) {
+        ret = pseudo_lock(&dev->wr_lock, iocb);
+        if (ret)
+            break;
+
+        // Target delay exceeded: tell the producer to back off
+        if (dev->sojourn && dev->sojourn->reject && pseudo_over_target(dev)) {
+            mutex_unlock(&dev->wr_lock);
+            ret = -ENOBUFS;
+            break;
+        }
+
+        if (fifo_is_full(&dev->fifo)) {
+            dev->stalls++;
+            mutex_unlock(&dev->wr_lock);
+            if (nonblock) {
+                ret = -EAGAIN;
+                break;
+            }
+            this_cpu_inc(dev->stats->waits);
+            trace_pseudo_wait(dev->id, true);
+            if (wait_event_interruptible(dev->wr_wq, !fifo_is_full(&dev->fifo))) {
+                ret = -ERESTARTSYS;
+                break;
+            }
+            trace_pseudo_wake(dev->id, true);
+            continue;
+        }
+
+        copied = fifo_from_iter(&dev->fifo, from, count - written);
+        if (copied)
+            pseudo_stamp(dev);
+        queued = fifo_len(&dev->fifo);
+        pseudo_autotune_note(dev, queued);
+        mutex_unlock(&dev->wr_lock);
+        if (!copied) {
+            ret = -EFAULT;
+            break;
+        }
+        written += copied;
+        trace_pseudo_enqueue(dev->id, copied, queued);
+        wake_up_interruptible(&dev->rd_wq);
+    }
+
+    // Report bytes already queued even if a signal or fault cut us short
+    return written ? written : ret;
+}
+
+// Count a finished read or write in this CPU's counters
+static void pseudo_account(struct pseudo_device *dev, bool writer, ssize_t ret)
+{
+    struct pseudo_stats *st = get_cpu_ptr(dev->stats);
+
+    if (ret < 0) {
+        if (ret != -EAGAIN)
+            st->fails++;
+    } else if (writer) {
+        st->wr_bytes += ret;
+        st->wr_ops++;
+    } else {
+        st->rd_bytes += ret;
+        st->rd_ops++;
+    }
+    put_cpu_ptr(dev->stats);
+}
+
+// Read function: Block while the FIFO is empty (also backs splice_read)
+static ssize_t pseudo_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+    struct pseudo_device *dev = pseudo_file_dev(iocb->ki_filp);
+    ssize_t ret = pseudo_do_read(iocb, to);
+
+    pseudo_account(dev, false, ret);
+    return ret;
+}
+
+// Write function: Block while the FIFO is full (also backs splice_write)
+static ssize_t pseudo_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+    struct pseudo_device *dev = pseudo_file_dev(iocb->ki_filp);
+    ssize_t ret = pseudo_do_write(iocb, from);
+
+    pseudo_account(dev, true, ret);
+    return ret;
+}
+
+// Poll function: readable with data queued (for this reader, in broadcast mode),
+// writable with space left, EPOLLPRI while the queueing delay is above its target
+static __poll_t pseudo_poll(struct file *filp, poll_table *wait)
+{
+    struct pseudo_file *pf = filp->private_data;
+    struct pseudo_device *dev = pf->dev;
+    __poll_t mask = 0;
+
+    poll_wait(filp, &dev->rd_wq, wait);
+    poll_wait(filp, &dev->wr_wq, wait);
+
+    if (pseudo_readable(pf))
+        mask |= EPOLLIN | EPOLLRDNORM;
+    if (!fifo_is_full(&dev->fifo) || READ_ONCE(dev->broadcast) == FIFO_BCAST_DROP)
+        mask |= EPOLLOUT | EPOLLWRNORM;
+    if (pseudo_over_target(dev))
+        mask |= EPOLLPRI;
+
+    return mask;
+}
+
+// Batch ioctls: move up to batch.count messages in one call. Only the first
+// message may block; the batch stops early once the FIFO is full or empty.
+static long pseudo_msg_batch(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+    struct fifo_msg_batch __user *ubatch = (void __user *)arg;
+    struct fifo_msg_batch batch;
+    struct iovec __user *uiov;
+    struct iovec iov;
+    struct iov_iter iter;
+    struct kiocb kiocb;
+    ssize_t ret = 0;
+    u32 i;
+
+    if (copy_from_user(&batch, ubatch, sizeof(batch)))
+        return -EFAULT;
+    uiov = u64_to_user_ptr(batch.iov);
+    init_sync_kiocb(&kiocb, filp);
+
+    for (i = 0; i < batch.count; i++) {
+        if (copy_from_user(&iov, &uiov[i], sizeof(iov))) {
+            ret = -EFAULT;
+            break;
+        }
+
+        if (cmd == MY_IOCTL_CMD_ENQ_BATCH) {
+            ret = import_single_range(WRITE, iov.iov_base, iov.iov_len, &iov, &iter);
+            if (!ret)
+                ret = pseudo_write_iter(&kiocb, &iter);
+        } else {
+            ret = import_single_range(READ, iov.iov_base, iov.iov_len, &iov, &iter);
+            if (!ret)
+                ret = pseudo_read_iter(&kiocb, &iter);
+            if (ret >= 0 && put_user(ret, &uiov[i].iov_len))
+                ret = -EFAULT;
+        }
+        if (ret < 0)
+            break;
+
+        kiocb.ki_flags |= IOCB_NOWAIT;
+    }
+
+    if (!i && batch.count)
+        return ret;
+    if (put_user(i, &ubatch->done))
+        return -EFAULT;
+    return i;
+}
+
+// Forwarder thread: move everything queued in src into dst, waiting for data
+// in src and for space in dst. A full dst leaves src full, so its writers block
+// exactly as if a slow reader were draining it.
+static int pseudo_link_fn(void *data)
+{
+    struct pseudo_link *link = data;
+    struct pseudo_device *src = link->src, *dst = link->dst;
+    unsigned int n, queued;
+
+    while (!kthread_should_stop()) {
+        if (fifo_is_empty(&src->fifo)) {
+            wait_event_interruptible(src->rd_wq, !fifo_is_empty(&src->fifo) ||
+                                                 kthread_should_stop());
+            continue;
+        }
+        if (fifo_is_full(&dst->fifo)) {
+            link->stalls++;
+            wait_event_interruptible(dst->wr_wq, !fifo_is_full(&dst->fifo) ||
+                                                 kthread_should_stop());
+            continue;
+        }
+
+        // Lock order across devices: src consumer, then dst producer. Links
+        // never form a cycle, so no other thread takes them the other way.
+        mutex_lock(&src->rd_lock);
+        mutex_lock(&dst->wr_lock);
+        n = fifo_move(&dst->fifo, &src->fifo);
+        if (n) {
+            pseudo_stamp(dst);
+            pseudo_sojourn_account(src);
+        }
+        queued = fifo_len(&dst->fifo);
+        pseudo_autotune_note(dst, queued);
+        mutex_unlock(&dst->wr_lock);
+        mutex_unlock(&src->rd_lock);
+        if (!n)
+            continue;
+
+        link->bytes += n;
+        link->moves++;
+        trace_pseudo_dequeue(src->id, n, fifo_len(&src->fifo));
+        trace_pseudo_enqueue(dst->id, n, queued);
+        wake_up_interruptible(&src->wr_wq);
+        wake_up_interruptible(&dst->rd_wq);
+    }
+    return 0;
+}
+
+// Start forwarding the output of the file's device into device 'target'. The
+// link belongs to this file; pf->dev stays open as long as it lives, and dst
+// is held open by the link itself.
+static int pseudo_link_set(struct pseudo_file *pf, long target)
+{
+    struct pseudo_device *src = pf->dev, *dst, *d;
+    struct pseudo_link *link;
+    int ret = 0;
+
+    xa_lock(&pseudo_xa);
+    dst = xa_load(&pseudo_xa, target);
+    if (dst)
+        get_device(&dst->dev);
+    xa_unlock(&pseudo_xa);
+    if (!dst)
+        return -ENOENT;
+
+    link = kzalloc(sizeof(*link), GFP_KERNEL);
+    if (!link) {
+        put_device(&dst->dev);
+        return -ENOMEM;
+    }
+    link->src = src;
+    link->dst = dst;
+    link->task = kthread_create(pseudo_link_fn, link, "pseudo%u>%u", src->id, dst->id);
+    if (IS_ERR(link->task)) {
+        ret = PTR_ERR(link->task);
+        kfree(link);
+        put_device(&dst->dev);
+        return ret;
+    }
 
-    // Step 5: Copy contents from the temporary array into the new FIFO
-    if (kfifo_in(fifo, temp_array, fifo_size) != fifo_size) {
-        pr_err("Failed to write all contents back to FIFO\n");
-        kfifo_free(fifo);
-        kfree(temp_array);
-        return -EIO;
+    mutex_lock(&pseudo_link_lock);
+    if (pf->link || src->link_out || dst->link_in) {
+        ret = -EBUSY;
+        goto unlock;
+    }
+    // Refuse loops, including src == dst
+    for (d = dst; d; d = d->link_out ? d->link_out->dst : NULL) {
+        if (d == src) {
+            ret = -ELOOP;
+            goto unlock;
+        }
     }
 
-    // Step 6: Release the temporary array
-    kfree(temp_array);
+    // Records and broadcast cursors do not survive a raw byte move
+    mutex_lock(&src->lock);
+    if (src->msg_mode || src->broadcast) {
+        mutex_unlock(&src->lock);
+        ret = -EINVAL;
+        goto unlock;
+    }
+    src->link_out = link;
+    mutex_unlock(&src->lock);
 
-    pr_info("FIFO resized successfully to %zu bytes\n", param);
+    mutex_lock(&dst->lock);
+    if (dst->dead) {
+        ret = -ENODEV;
+    } else if (dst->msg_mode || dst->broadcast) {
+        ret = -EINVAL;
+    } else {
+        ret = pseudo_fifo_get(dst);
+        if (!ret) {
+            dst->open_count++;
+            dst->link_in = link;
+        }
+    }
+    mutex_unlock(&dst->lock);
+    if (ret) {
+        mutex_lock(&src->lock);
+        src->link_out = NULL;
+        mutex_unlock(&src->lock);
+        goto unlock;
+    }
+
+    pf->link = link;
+    link->start = ktime_get();
+    wake_up_process(link->task);
+unlock:
+    mutex_unlock(&pseudo_link_lock);
+    if (ret) {
+        kthread_stop(link->task);
+        kfree(link);
+        put_device(&dst->dev);
+    }
+    return ret;
+}
 
+// Stop the forwarder set up through this file and let go of its target
+static int pseudo_unlink(struct pseudo_file *pf)
+{
+    struct pseudo_link *link;
+    struct pseudo_device *dst;
+
+    mutex_lock(&pseudo_link_lock);
+    link = pf->link;
+    if (!link) {
+        mutex_unlock(&pseudo_link_lock);
+        return -ENOENT;
+    }
+    dst = link->dst;
+    mutex_lock(&link->src->lock);
+    link->src->link_out = NULL;
+    mutex_unlock(&link->src->lock);
+    mutex_lock(&dst->lock);
+    dst->link_in = NULL;
+    mutex_unlock(&dst->lock);
+    pf->link = NULL;
+    mutex_unlock(&pseudo_link_lock);
+
+    // Whatever is already in dst stays there for its readers
+    kthread_stop(link->task);
+    pr_debug("Unlinked pseudo%u -> pseudo%u after %llu bytes\n",
+             link->src->id, dst->id, link->bytes);
+    kfree(link);
+
+    mutex_lock(&dst->lock);
+    if (!--dst->open_count)
+        schedule_delayed_work(&dst->idle_work, msecs_to_jiffies(idle_ms));
+    mutex_unlock(&dst->lock);
+    put_device(&dst->dev);
     return 0;
 }
 
@@ -115,30 +1506,413 @@ int fifo_resize(struct kfifo *fifo, size_t param)
 static int pseudo_open(struct inode *inode, struct file *filp)
 {
     struct pseudo_device *dev;
+    struct pseudo_file *pf;
+    int ret;
 
-    // Get the device structure from the inode
+    // Get the device structure from the inode; the open cdev pins it
     dev = container_of(inode->i_cdev, struct pseudo_device, cdev);
-    filp->private_data = dev;  // Store the device pointer in the file struct
-    pr_info("Opened pseudo device\n");
+
+    pf = kzalloc(sizeof(*pf), GFP_KERNEL);
+    if (!pf)
+        return -ENOMEM;
+    pf->dev = dev;
+    pf->pid = task_tgid_nr(current);
+    INIT_LIST_HEAD(&pf->node);
+
+    mutex_lock(&dev->lock);
+    ret = pseudo_fifo_get(dev);
+    if (!ret) {
+        dev->open_count++;
+        // A new broadcast reader starts with the oldest byte still queued
+        if (filp->f_mode & FMODE_READ) {
+            mutex_lock(&dev->rd_lock);
+            pf->cursor = dev->fifo.out;
+            list_add_tail(&pf->node, &dev->readers);
+            mutex_unlock(&dev->rd_lock);
+        }
+    }
+    mutex_unlock(&dev->lock);
+    if (ret) {
+        kfree(pf);
+        return ret;
+    }
+
+    filp->private_data = pf;  // Store the device pointer and read cursor in the file struct
+    // read_iter/write_iter honour IOCB_NOWAIT, so io_uring may issue inline
+    filp->f_mode |= FMODE_NOWAIT;
+    pr_debug("Opened pseudo device %u\n", dev->id);
     return 0;
 }
 
 // Release function for the device
 static int pseudo_release(struct inode *inode, struct file *filp)
 {
-    struct pseudo_device *dev = filp->private_data;
-    pr_info("Closed pseudo device\n");
+    struct pseudo_file *pf = filp->private_data;
+    struct pseudo_device *dev = pf->dev;
+
+    // Stop forwarding before the source loses its last opener
+    if (pf->link)
+        pseudo_unlink(pf);
+
+    mutex_lock(&dev->lock);
+    if (!list_empty(&pf->node)) {
+        // A slow broadcast reader leaving may free space for the writers
+        mutex_lock(&dev->rd_lock);
+        list_del(&pf->node);
+        if (dev->broadcast)
+            pseudo_bcast_advance(dev);
+        mutex_unlock(&dev->rd_lock);
+        wake_up_interruptible(&dev->wr_wq);
+    }
+    if (!--dev->open_count)
+        schedule_delayed_work(&dev->idle_work, msecs_to_jiffies(idle_ms));
+    mutex_unlock(&dev->lock);
+    kfree(pf);
+
+    pr_debug("Closed pseudo device %u\n", dev->id);
+    return 0;
+}
+
+// sysfs: /sys/class/pseudo_char_device/pseudoN/{fifo_size,autotune,...}
+static ssize_t fifo_size_show(struct device *d, struct device_attribute *attr, char *buf)
+{
+    struct pseudo_device *dev = dev_get_drvdata(d);
+    unsigned int size;
+
+    mutex_lock(&dev->lock);
+    size = dev->fifo.data ? fifo_size(&dev->fifo) : 0;
+    mutex_unlock(&dev->lock);
+    return sysfs_emit(buf, "%u\n", size);
+}
+static DEVICE_ATTR_RO(fifo_size);
+
+static ssize_t autotune_show(struct device *d, struct device_attribute *attr, char *buf)
+{
+    struct pseudo_device *dev = dev_get_drvdata(d);
+    ssize_t len;
+
+    mutex_lock(&dev->lock);
+    len = sysfs_emit(buf, "enabled=%d min=%u max=%u high_watermark=%u stalls=%u grows=%lu shrinks=%lu\n",
+                     dev->autotune, dev->min_size, dev->max_size, dev->high_watermark,
+                     dev->stalls, dev->grows, dev->shrinks);
+    mutex_unlock(&dev->lock);
+    return len;
+}
+
+// Accepts "<enable> <min_size> <max_size>"
+static ssize_t autotune_store(struct device *d, struct device_attribute *attr,
+                              const char *buf, size_t count)
+{
+    struct pseudo_device *dev = dev_get_drvdata(d);
+    unsigned int enable, min_size, max_size;
+    int ret;
+
+    if (sscanf(buf, "%u %u %u", &enable, &min_size, &max_size) != 3)
+        return -EINVAL;
+    ret = pseudo_autotune_set(dev, enable, min_size, max_size);
+    return ret ? ret : count;
+}
+static DEVICE_ATTR_RW(autotune);
+
+static ssize_t stats_show(struct device *d, struct device_attribute *attr, char *buf)
+{
+    struct pseudo_device *dev = dev_get_drvdata(d);
+    struct pseudo_stats sum = {};
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        struct pseudo_stats *st = per_cpu_ptr(dev->stats, cpu);
+
+        sum.rd_bytes += st->rd_bytes;
+        sum.wr_bytes += st->wr_bytes;
+        sum.rd_ops += st->rd_ops;
+        sum.wr_ops += st->wr_ops;
+        sum.waits += st->waits;
+        sum.fails += st->fails;
+    }
+    return sysfs_emit(buf, "rd_bytes=%llu wr_bytes=%llu rd_ops=%llu wr_ops=%llu waits=%llu fails=%llu\n",
+                      sum.rd_bytes, sum.wr_bytes, sum.rd_ops, sum.wr_ops, sum.waits, sum.fails);
+}
+static DEVICE_ATTR_RO(stats);
+
+// One line per open reader: bytes it has yet to read and, in broadcast mode,
+// bytes a lossy writer overwrote before it got them
+static ssize_t readers_show(struct device *d, struct device_attribute *attr, char *buf)
+{
+    static const char * const modes[] = { "off", "block", "drop" };
+    struct pseudo_device *dev = dev_get_drvdata(d);
+    struct pseudo_file *pf;
+    unsigned int in, out, lag;
+    ssize_t len;
+
+    mutex_lock(&dev->rd_lock);
+    in = READ_ONCE(dev->fifo.in);
+    out = dev->fifo.out;
+    len = sysfs_emit(buf, "broadcast=%s\n", modes[dev->broadcast]);
+    list_for_each_entry(pf, &dev->readers, node) {
+        if (len >= PAGE_SIZE - 64)
+            break;
+        // Shared stream, or a lapped reader that resumes at 'out'
+        if (!dev->broadcast || (int)(pf->cursor - out) < 0)
+            lag = in - out;
+        else
+            lag = in - pf->cursor;
+        len += sysfs_emit_at(buf, len, "pid=%d lag=%u dropped=%llu\n",
+                             pf->pid, lag, pf->dropped);
+    }
+    mutex_unlock(&dev->rd_lock);
+    return len;
+}
+static DEVICE_ATTR_RO(readers);
+
+// Forwarding link out of this device, with its throughput so far
+static ssize_t link_show(struct device *d, struct device_attribute *attr, char *buf)
+{
+    struct pseudo_device *dev = dev_get_drvdata(d);
+    struct pseudo_link *link;
+    u64 bytes, ms;
+    ssize_t len;
+
+    mutex_lock(&pseudo_link_lock);
+    link = dev->link_out;
+    if (!link) {
+        len = sysfs_emit(buf, "none\n");
+    } else {
+        bytes = READ_ONCE(link->bytes);
+        ms = max_t(u64, ktime_ms_delta(ktime_get(), link->start), 1);
+        len = sysfs_emit(buf, "dst=pseudo%u bytes=%llu moves=%llu stalls=%llu bytes_per_sec=%llu\n",
+                         link->dst->id, bytes, READ_ONCE(link->moves),
+                         READ_ONCE(link->stalls), div64_u64(bytes * 1000, ms));
+    }
+    mutex_unlock(&pseudo_link_lock);
+    return len;
+}
+static DEVICE_ATTR_RO(link);
+
+// Configured NUMA node (-1: the opener's) and where the FIFO buffer actually is
+static ssize_t numa_node_show(struct device *d, struct device_attribute *attr, char *buf)
+{
+    struct pseudo_device *dev = dev_get_drvdata(d);
+    int node, fifo_node = NUMA_NO_NODE;
+
+    mutex_lock(&dev->lock);
+    node = dev->node;
+    if (dev->fifo.data)
+        fifo_node = pseudo_buf_node(dev->fifo.data);
+    mutex_unlock(&dev->lock);
+    return sysfs_emit(buf, "node=%d fifo_node=%d\n", node, fifo_node);
+}
+
+// Accepts a node number, or -1 to follow the opener
+static ssize_t numa_node_store(struct device *d, struct device_attribute *attr,
+                               const char *buf, size_t count)
+{
+    struct pseudo_device *dev = dev_get_drvdata(d);
+    int node, ret;
+
+    ret = kstrtoint(buf, 0, &node);
+    if (!ret)
+        ret = pseudo_node_set(dev, node);
+    return ret ? ret : count;
+}
+static DEVICE_ATTR_RW(numa_node);
+
+static struct attribute *pseudo_attrs[] = {
+    &dev_attr_fifo_size.attr,
+    &dev_attr_autotune.attr,
+    &dev_attr_stats.attr,
+    &dev_attr_readers.attr,
+    &dev_attr_link.attr,
+    &dev_attr_numa_node.attr,
+    NULL,
+};
+ATTRIBUTE_GROUPS(pseudo);
+
+// debugfs: /sys/kernel/debug/pseudo/pseudoN/sojourn
+static int pseudo_sojourn_show(struct seq_file *m, void *v)
+{
+    struct pseudo_device *dev = m->private;
+    struct pseudo_sojourn *sj;
+    int i;
+
+    mutex_lock(&dev->rd_lock);
+    sj = dev->sojourn;
+    if (!sj) {
+        seq_puts(m, "disabled\n");
+    } else {
+        seq_printf(m, "target_us=%llu interval_us=%llu reject=%d over_target=%d\n",
+                   sj->target_ns / NSEC_PER_USEC, sj->interval_ns / NSEC_PER_USEC,
+                   sj->reject, dev->over_target);
+        for (i = 0; i < SOJOURN_BUCKETS; i++)
+            seq_printf(m, "%s%10lu us: %llu\n", i == SOJOURN_BUCKETS - 1 ? ">=" : "< ",
+                       i == SOJOURN_BUCKETS - 1 ? 1UL << i : 2UL << i, sj->hist[i]);
+    }
+    mutex_unlock(&dev->rd_lock);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(pseudo_sojourn);
+
+// Final put of a device: no opener, node or worker can reach it any more
+static void pseudo_dev_release(struct device *d)
+{
+    struct pseudo_device *dev = container_of(d, struct pseudo_device, dev);
+
+    cancel_delayed_work_sync(&dev->autotune_work);
+    cancel_delayed_work_sync(&dev->idle_work);
+    if (dev->fifo.data)
+        pseudo_fifo_put(dev);
+    free_percpu(dev->stats);
+    kfree(dev->sojourn);
+    kfree(dev);
+}
+
+// Create one pseudo device with the lowest free minor number
+static int pseudo_create(u32 *id)
+{
+    struct pseudo_device *dev;
+    int result;
+
+    dev = kzalloc(sizeof(*dev), GFP_KERNEL);
+    if (!dev)
+        return -ENOMEM;
+    dev->stats = alloc_percpu(struct pseudo_stats);
+    if (!dev->stats) {
+        kfree(dev);
+        return -ENOMEM;
+    }
+
+    mutex_init(&dev->lock);
+    mutex_init(&dev->rd_lock);
+    mutex_init(&dev->wr_lock);
+    init_waitqueue_head(&dev->rd_wq);
+    init_waitqueue_head(&dev->wr_wq);
+    INIT_LIST_HEAD(&dev->readers);
+    INIT_DELAYED_WORK(&dev->autotune_work, pseudo_autotune_work);
+    INIT_DELAYED_WORK(&dev->idle_work, pseudo_idle_work);
+    dev->min_size = PSEUDO_FIFO_SIZE;
+    dev->max_size = PSEUDO_FIFO_SIZE;
+    dev->node = NUMA_NO_NODE;
+
+    // Reserve the index first, the device is published once it is complete
+    result = xa_alloc(&pseudo_xa, id, NULL, XA_LIMIT(0, max_devices - 1), GFP_KERNEL);
+    if (result) {
+        free_percpu(dev->stats);
+        kfree(dev);
+        return result;
+    }
+    dev->id = *id;
+
+    device_initialize(&dev->dev);
+    dev->dev.class = dev_class;
+    dev->dev.devt = MKDEV(major_num, dev->id);
+    dev->dev.groups = pseudo_groups;
+    dev->dev.release = pseudo_dev_release;
+    dev_set_drvdata(&dev->dev, dev);
+    result = dev_set_name(&dev->dev, "pseudo%u", dev->id);
+    if (result)
+        goto err_put;
+
+    cdev_init(&dev->cdev, &pseudo_fops);
+    dev->cdev.owner = THIS_MODULE;
+
+    // Adds the cdev and creates /dev/pseudoN
+    result = cdev_device_add(&dev->cdev, &dev->dev);
+    if (result)
+        goto err_put;
+
+    dev->debugfs = debugfs_create_dir(dev_name(&dev->dev), pseudo_debugfs);
+    debugfs_create_file("sojourn", 0444, dev->debugfs, dev, &pseudo_sojourn_fops);
+
+    xa_store(&pseudo_xa, dev->id, dev, GFP_KERNEL);
     return 0;
+
+err_put:
+    xa_erase(&pseudo_xa, dev->id);
+    put_device(&dev->dev);
+    return result;
+}
+
+// Remove a pseudo device; open files keep it alive until they are closed
+static int pseudo_destroy(u32 id)
+{
+    struct pseudo_device *dev = xa_erase(&pseudo_xa, id);
+
+    if (!dev)
+        return -ENOENT;
+
+    mutex_lock(&dev->lock);
+    dev->dead = true;
+    dev->autotune = false;
+    mutex_unlock(&dev->lock);
+    cancel_delayed_work_sync(&dev->autotune_work);
+
+    debugfs_remove_recursive(dev->debugfs);
+    cdev_device_del(&dev->cdev, &dev->dev);
+    put_device(&dev->dev);
+    return 0;
+}
+
+// Control device: create and destroy pseudo devices at runtime
+static long pseudo_ctl_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+    u32 id;
+    int result;
+
+    switch (cmd) {
+        case MY_IOCTL_CMD_CREATE_DEVICE:
+            result = pseudo_create(&id);
+            if (result)
+                return result;
+            if (put_user(id, (__u32 __user *)arg)) {
+                pseudo_destroy(id);
+                return -EFAULT;
+            }
+            return 0;
+
+        case MY_IOCTL_CMD_DESTROY_DEVICE:
+            if (get_user(id, (__u32 __user *)arg))
+                return -EFAULT;
+            return pseudo_destroy(id);
+
+        default:
+            return -ENOTTY;
+    }
+}
+
+static const struct file_operations pseudo_ctl_fops = {
+    .owner = THIS_MODULE,
+    .unlocked_ioctl = pseudo_ctl_ioctl,
+};
+
+static struct miscdevice pseudo_ctl = {
+    .minor = MISC_DYNAMIC_MINOR,
+    .name = "pseudo_ctl",
+    .fops = &pseudo_ctl_fops,
+};
+
+// Destroy every remaining device
+static void pseudo_destroy_all(void)
+{
+    struct pseudo_device *dev;
+    unsigned long id;
+
+    xa_for_each(&pseudo_xa, id, dev)
+        pseudo_destroy(id);
 }
 
 // Initialize the device driver
 static int __init pchar_init(void)
 {
+    ktime_t start = ktime_get();
     int result;
     dev_t dev;
+    u32 id;
+
+    if (!max_devices || max_devices > MINORMASK + 1 || ndevices > max_devices)
+        return -EINVAL;
 
-    // Allocate a major number dynamically
-    result = alloc_chrdev_region(&dev, 0, DEVICE_COUNT, DEVICE_NAME);
+    // Allocate a major number dynamically, with a minor for every possible device
+    result = alloc_chrdev_region(&dev, 0, max_devices, DEVICE_NAME);
     if (result < 0) {
         pr_err("Failed to allocate character device region\n");
         return result;
@@ -148,53 +1922,65 @@ static int __init pchar_init(void)
     // Create device class
     dev_class = class_create(THIS_MODULE, DEVICE_NAME);
     if (IS_ERR(dev_class)) {
-        unregister_chrdev_region(dev, DEVICE_COUNT);
         pr_err("Failed to create device class\n");
-        return PTR_ERR(dev_class);
+        result = PTR_ERR(dev_class);
+        goto err_region;
     }
 
-    // Initialize each device
-    for (int i = 0; i < DEVICE_COUNT; i++) {
-        devices[i] = kzalloc(sizeof(struct pseudo_device), GFP_KERNEL);
-        if (!devices[i]) {
-            pr_err("Failed to allocate memory for device %d\n", i);
-            return -ENOMEM;
-        }
+    pseudo_debugfs = debugfs_create_dir("pseudo", NULL);
 
-        // Initialize the FIFO for each device
-        if (kfifo_alloc(&devices[i]->fifo, 1024, GFP_KERNEL)) {
-            pr_err("Failed to allocate FIFO for device %d\n", i);
-            return -ENOMEM;
-        }
-
-        cdev_init(&devices[i]->cdev, &pseudo_fops);
-        devices[i]->cdev.owner = THIS_MODULE;
+    // Dedicated cache for the lazily allocated FIFO buffers
+    fifo_cache = kmem_cache_create("pseudo_fifo", PSEUDO_FIFO_SIZE, 0, SLAB_HWCACHE_ALIGN, NULL);
+    if (!fifo_cache) {
+        result = -ENOMEM;
+        goto err_class;
+    }
 
-        result = cdev_add(&devices[i]->cdev, MKDEV(major_num, i), 1);
+    // Initialize each device; no FIFO memory is used until it is opened
+    for (unsigned int i = 0; i < ndevices; i++) {
+        result = pseudo_create(&id);
         if (result) {
-            pr_err("Failed to add cdev for device %d\n", i);
-            return result;
+            pr_err("Failed to create device %u\n", i);
+            goto err_devices;
         }
+    }
 
-        // Create device file in /dev
-        device_create(dev_class, NULL, MKDEV(major_num, i), NULL, "pseudo%d", i);
+    result = misc_register(&pseudo_ctl);
+    if (result) {
+        pr_err("Failed to register control device\n");
+        goto err_devices;
     }
 
-    pr_info("Pseudo character device driver initialized\n");
+    // A lower bound: what the driver allocates itself per idle device. The
+    // kobject name, sysfs attribute nodes and debugfs dentries and inodes
+    // are allocated by the core on its behalf and cannot be sized from here.
+    pr_info("Pseudo character device driver initialized: %u devices in %lld us\n",
+            ndevices, ktime_us_delta(ktime_get(), start));
+    pr_info("Idle device: %zu bytes of struct pseudo_device (struct device and cdev embedded) + %zu of per-CPU stats; kobject name, sysfs and debugfs nodes not counted\n",
+            sizeof(struct pseudo_device), sizeof(struct pseudo_stats) * num_possible_cpus());
     return 0;
+
+err_devices:
+    pseudo_destroy_all();
+    kmem_cache_destroy(fifo_cache);
+err_class:
+    debugfs_remove_recursive(pseudo_debugfs);
+    class_destroy(dev_class);
+err_region:
+    unregister_chrdev_region(dev, max_devices);
+    return result;
 }
 
 // Cleanup the device driver
 static void __exit pchar_exit(void)
 {
-    for (int i = 0; i < DEVICE_COUNT; i++) {
-        device_destroy(dev_class, MKDEV(major_num, i));
-        cdev_del(&devices[i]->cdev);
-        kfifo_free(&devices[i]->fifo);
-        kfree(devices[i]);
-    }
+    misc_deregister(&pseudo_ctl);
+    pseudo_destroy_all();
+    xa_destroy(&pseudo_xa);
+    debugfs_remove_recursive(pseudo_debugfs);
+    kmem_cache_destroy(fifo_cache);
     class_destroy(dev_class);
-    unregister_chrdev_region(MKDEV(major_num, 0), DEVICE_COUNT);
+    unregister_chrdev_region(MKDEV(major_num, 0), max_devices);
     pr_info("Pseudo character device driver cleaned up\n");
 }
 
@@ -24,49 +24,40 @@ static void __exit pchar_exit(void)
     pr_info("Pseudo char driver exited\n");
 }
 
-// FIFO resize function
+// FIFO resize function: the caller keeps readers and writers out meanwhile
 int fifo_resize(struct kfifo *fifo, size_t param)
 {
-    void *temp_array;
-    size_t fifo_size;
+    struct kfifo new_fifo, old_fifo;
+    unsigned int len;
+    int ret;
 
-    // Step 1: Allocate a temporary array to store FIFO contents
-    fifo_size = kfifo_size(fifo);
-    temp_array = kmalloc(fifo_size, GFP_KERNEL);
-    if (!temp_array) {
-        pr_err("Failed to allocate memory for temp array\n");
-        return -ENOMEM;
+    // Step 1: Allocate the new FIFO first, the old one stays untouched on failure
+    ret = kfifo_alloc(&new_fifo, param, GFP_KERNEL);
+    if (ret) {
+        pr_err("Failed to allocate new FIFO memory\n");
+        return ret;
     }
 
-    // Step 2: Copy FIFO contents into the temporary array
-    if (kfifo_out(fifo, temp_array, fifo_size) != fifo_size) {
-        pr_err("Failed to read all contents from FIFO\n");
-        kfree(temp_array);
-        return -EIO;
+    // Step 2: Refuse to shrink below what is queued, so no data is ever dropped
+    len = kfifo_len(fifo);
+    if (len > kfifo_size(&new_fifo)) {
+        pr_err("FIFO holds %u bytes, more than the new size\n", len);
+        kfifo_free(&new_fifo);
+        return -ENOSPC;
     }
 
-    // Step 3: Release FIFO memory
-    kfifo_free(fifo);
+    // Step 3: Move only the queued bytes straight into the new buffer
+    len = kfifo_out(fifo, new_fifo.kfifo.data, len);
+    new_fifo.kfifo.in = len;
 
-    // Step 4: Allocate new memory for the FIFO with the new size 'param'
-    if (kfifo_alloc(fifo, param, GFP_KERNEL)) {
-        pr_err("Failed to allocate new FIFO memory\n");
-        kfree(temp_array);
-        return -ENOMEM;
-    }
-
-    // Step 5: Copy contents from the temporary array into the new FIFO
-    if (kfifo_in(fifo, temp_array, fifo_size) != fifo_size) {
-        pr_err("Failed to write all contents back to FIFO\n");
-        kfifo_free(fifo);
-        kfree(temp_array);
-        return -EIO;
-    }
+    // Step 4: Swap in the new FIFO
+    old_fifo = *fifo;
+    *fifo = new_fifo;
 
-    // Step 6: Release the temporary array
-    kfree(temp_array);
+    // Step 5: Release the old buffer, nobody can reach it any more
+    kfifo_free(&old_fifo);
 
-    pr_info("FIFO resized successfully to %zu bytes\n", param);
+    pr_info("FIFO resized successfully to %u bytes\n", kfifo_size(&new_fifo));
 
     return 0;
 }
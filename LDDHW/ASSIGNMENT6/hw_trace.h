@@ -0,0 +1,80 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM pseudo
+
+#if !defined(_HW_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _HW_TRACE_H
+
+#include <linux/tracepoint.h>
+
+// Data moved into or out of a device FIFO; 'queued' is the occupancy afterwards
+DECLARE_EVENT_CLASS(pseudo_xfer,
+    TP_PROTO(unsigned int id, size_t bytes, unsigned int queued),
+    TP_ARGS(id, bytes, queued),
+    TP_STRUCT__entry(
+        __field(unsigned int, id)
+        __field(size_t, bytes)
+        __field(unsigned int, queued)
+    ),
+    TP_fast_assign(
+        __entry->id = id;
+        __entry->bytes = bytes;
+        __entry->queued = queued;
+    ),
+    TP_printk("pseudo%u bytes=%zu queued=%u", __entry->id, __entry->bytes, __entry->queued)
+);
+
+DEFINE_EVENT(pseudo_xfer, pseudo_enqueue,
+    TP_PROTO(unsigned int id, size_t bytes, unsigned int queued),
+    TP_ARGS(id, bytes, queued));
+
+DEFINE_EVENT(pseudo_xfer, pseudo_dequeue,
+    TP_PROTO(unsigned int id, size_t bytes, unsigned int queued),
+    TP_ARGS(id, bytes, queued));
+
+// A reader or writer going to sleep on the FIFO, and resuming
+DECLARE_EVENT_CLASS(pseudo_sleep,
+    TP_PROTO(unsigned int id, bool writer),
+    TP_ARGS(id, writer),
+    TP_STRUCT__entry(
+        __field(unsigned int, id)
+        __field(bool, writer)
+    ),
+    TP_fast_assign(
+        __entry->id = id;
+        __entry->writer = writer;
+    ),
+    TP_printk("pseudo%u %s", __entry->id, __entry->writer ? "writer" : "reader")
+);
+
+DEFINE_EVENT(pseudo_sleep, pseudo_wait,
+    TP_PROTO(unsigned int id, bool writer),
+    TP_ARGS(id, writer));
+
+DEFINE_EVENT(pseudo_sleep, pseudo_wake,
+    TP_PROTO(unsigned int id, bool writer),
+    TP_ARGS(id, writer));
+
+TRACE_EVENT(pseudo_resize,
+    TP_PROTO(unsigned int id, unsigned int old_size, unsigned int new_size),
+    TP_ARGS(id, old_size, new_size),
+    TP_STRUCT__entry(
+        __field(unsigned int, id)
+        __field(unsigned int, old_size)
+        __field(unsigned int, new_size)
+    ),
+    TP_fast_assign(
+        __entry->id = id;
+        __entry->old_size = old_size;
+        __entry->new_size = new_size;
+    ),
+    TP_printk("pseudo%u %u -> %u bytes", __entry->id, __entry->old_size, __entry->new_size)
+);
+
+#endif /* _HW_TRACE_H */
+
+// This part must be outside the header guard
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE hw_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,147 @@
+// Userspace benchmark: random 4 KiB accesses to the hw72.c buffer through
+// pread/pwrite against loads and stores on an mmap of it.
+//
+// Each run picks block-aligned offsets at random over the whole buffer and
+// copies -s bytes out of (or, for a write, into) it. Read-only runs and runs
+// where half the accesses are writes are shown for both paths. Note that
+// stores through the mapping bypass the driver's range locks.
+//
+//   insmod hw72.ko buf_size=1073741824
+//   make bench && ./bench_mmap -d /dev/pchar
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *dev_path = "/dev/pchar";
+static size_t block = 4096;
+static double seconds = 1.0;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// xorshift64, cheap enough not to show up next to a 4 KiB copy
+static unsigned long long next_rand(unsigned long long *s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+// Random accesses for 'seconds', half of them writes if 'writes'; returns
+// accesses per second or -1
+static double run(int fd, char *map, off_t size, int writes)
+{
+    unsigned long long seed = 0x9e3779b97f4a7c15ULL, ops = 0, r;
+    off_t blocks = size / block, pos;
+    char *buf = malloc(block);
+    double start = now(), elapsed;
+    ssize_t n = 0;
+
+    if (!buf)
+        return -1;
+    memset(buf, 'm', block);
+
+    do {
+        // Check the clock only every 1024 accesses
+        for (unsigned int i = 0; i < 1024; i++) {
+            r = next_rand(&seed);
+            pos = (off_t)(r % blocks) * block;
+            if (writes && (r >> 63))
+                n = map ? (memcpy(map + pos, buf, block), (ssize_t)block)
+                        : pwrite(fd, buf, block, pos);
+            else
+                n = map ? (memcpy(buf, map + pos, block), (ssize_t)block)
+                        : pread(fd, buf, block, pos);
+            if (n < 0)
+                break;
+        }
+        ops += 1024;
+        elapsed = now() - start;
+    } while (n >= 0 && elapsed < seconds);
+
+    free(buf);
+    if (n < 0) {
+        perror("pread/pwrite");
+        return -1;
+    }
+    return ops / elapsed;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-d device] [-s bytes per access] [-t seconds per run]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    double res[4];
+    off_t size;
+    char *map;
+    int opt, fd, i;
+
+    while ((opt = getopt(argc, argv, "d:s:t:")) != -1) {
+        switch (opt) {
+            case 'd':
+                dev_path = optarg;
+                break;
+            case 's':
+                block = atol(optarg);
+                break;
+            case 't':
+                seconds = atof(optarg);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (!block || seconds <= 0)
+        usage(argv[0]);
+
+    fd = open(dev_path, O_RDWR);
+    if (fd < 0) {
+        perror(dev_path);
+        return 1;
+    }
+    // The driver's llseek reports the buffer size at SEEK_END
+    size = lseek(fd, 0, SEEK_END);
+    if (size < (off_t)block) {
+        fprintf(stderr, "%s: buffer smaller than one access\n", dev_path);
+        return 1;
+    }
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    // Fault the whole mapping in first, the runs should not measure page faults
+    for (off_t pos = 0; pos < size; pos += 4096)
+        (void)*(volatile char *)(map + pos);
+
+    // i: bit 0 = mmap, bit 1 = half writes
+    for (i = 0; i < 4; i++) {
+        res[i] = run(fd, i & 1 ? map : NULL, size, i >> 1);
+        if (res[i] < 0)
+            return 1;
+    }
+
+    printf("%10s %14s %14s %8s\n", "access", "syscall_ops/s", "mmap_ops/s", "speedup");
+    printf("%10s %14.0f %14.0f %8.1f\n", "read", res[0], res[1], res[1] / res[0]);
+    printf("%10s %14.0f %14.0f %8.1f\n", "50% write", res[2], res[3], res[3] / res[2]);
+
+    munmap(map, size);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,194 @@
+// Userspace scaling benchmark for the shared hw72.c buffer.
+//
+// T threads each open the device and pread() -s bytes at a time from their
+// own slice of the buffer, for T = 1, 2, 4, ... up to -j. Prints total
+// reads per second next to T times the one-thread figure. With -w N every
+// Nth access is a pwrite, with -o all threads hit the same offset, so the
+// range lock's conflict path can be compared with the disjoint one.
+//
+//   insmod hw72.ko shared=1 buf_size=16777216
+//   make bench && ./bench_range -d /dev/pchar -j 8
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_THREADS 256
+
+static const char *dev_path = "/dev/pchar";
+static unsigned int max_threads = 4;
+static size_t chunk = 4096;
+static unsigned int write_every;   // 0 = reads only
+static int same_offset;
+static off_t buf_size;
+static double seconds = 1.0;
+static volatile int stop;
+
+struct worker {
+    pthread_t thread;
+    unsigned int id, nthreads;
+    unsigned long long ops;
+    int err;
+};
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *worker_fn(void *arg)
+{
+    struct worker *w = arg;
+    char *buf = malloc(chunk);
+    off_t slice, base, pos = 0;
+    ssize_t n;
+    int fd;
+
+    fd = open(dev_path, O_RDWR);
+    if (fd < 0 || !buf) {
+        w->err = errno;
+        goto out;
+    }
+    memset(buf, 'r', chunk);
+
+    // Without -o each thread walks its own slice, so no two touch the same bytes
+    slice = (off_t)chunk;
+    if (!same_offset)
+        slice *= buf_size / w->nthreads / (off_t)chunk;
+    base = same_offset ? 0 : slice * w->id;
+    if (slice < (off_t)chunk) {
+        w->err = EINVAL;
+        goto out;
+    }
+
+    while (!stop) {
+        if (write_every && w->ops % write_every == write_every - 1)
+            n = pwrite(fd, buf, chunk, base + pos);
+        else
+            n = pread(fd, buf, chunk, base + pos);
+        if (n < 0) {
+            w->err = errno;
+            break;
+        }
+        w->ops++;
+        pos += chunk;
+        if (pos + (off_t)chunk > slice)
+            pos = 0;
+    }
+out:
+    if (fd >= 0)
+        close(fd);
+    free(buf);
+    return NULL;
+}
+
+// Run with 'nthreads' threads, return accesses per second or -1
+static double run(unsigned int nthreads)
+{
+    static struct worker workers[MAX_THREADS];
+    unsigned long long ops = 0;
+    double start, elapsed;
+    unsigned int i;
+    int err = 0;
+
+    memset(workers, 0, sizeof(workers));
+    stop = 0;
+    for (i = 0; i < nthreads; i++) {
+        workers[i].id = i;
+        workers[i].nthreads = nthreads;
+        pthread_create(&workers[i].thread, NULL, worker_fn, &workers[i]);
+    }
+
+    start = now();
+    usleep(seconds * 1e6);
+    stop = 1;
+    elapsed = now() - start;
+
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        ops += workers[i].ops;
+        if (workers[i].err && !err)
+            err = workers[i].err;
+    }
+    if (err) {
+        fprintf(stderr, "%u threads: %s\n", nthreads, strerror(err));
+        return -1;
+    }
+    return ops / elapsed;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-d device] [-j max threads] [-s bytes per access] "
+            "[-w write every N] [-o] [-t seconds per step]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    double one = 0, ops;
+    unsigned int t;
+    int opt, fd;
+
+    while ((opt = getopt(argc, argv, "d:j:s:w:ot:")) != -1) {
+        switch (opt) {
+            case 'd':
+                dev_path = optarg;
+                break;
+            case 'j':
+                max_threads = atoi(optarg);
+                break;
+            case 's':
+                chunk = atol(optarg);
+                break;
+            case 'w':
+                write_every = atoi(optarg);
+                break;
+            case 'o':
+                same_offset = 1;
+                break;
+            case 't':
+                seconds = atof(optarg);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (!max_threads || max_threads > MAX_THREADS || !chunk || seconds <= 0)
+        usage(argv[0]);
+
+    // The driver's llseek reports the buffer size at SEEK_END
+    fd = open(dev_path, O_RDONLY);
+    if (fd < 0) {
+        perror(dev_path);
+        return 1;
+    }
+    buf_size = lseek(fd, 0, SEEK_END);
+    close(fd);
+    if (buf_size <= 0) {
+        fprintf(stderr, "%s: cannot tell the buffer size\n", dev_path);
+        return 1;
+    }
+
+    printf("%8s %14s %14s %12s\n", "threads", "ops/s", "linear_ops/s", "MB/s");
+    for (t = 1;; t = t * 2 < max_threads ? t * 2 : max_threads) {
+        ops = run(t);
+        if (ops < 0)
+            return 1;
+        if (t == 1)
+            one = ops;
+        printf("%8u %14.0f %14.0f %12.1f\n", t, ops, one * t, ops * chunk / 1e6);
+        if (t == max_threads)
+            break;
+    }
+    return 0;
+}
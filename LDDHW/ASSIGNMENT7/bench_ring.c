@@ -0,0 +1,362 @@
+// Userspace benchmark: the mmap'ed pchar ring (hw7.c) against read/write.
+//
+// For each message size a producer thread sends timestamped messages to a
+// consumer thread, once through the shared ring and once through read and
+// write on the device. Two figures per path:
+//   MB/s   streaming, the producer sends as fast as the consumer takes them
+//   lat_us one-way latency of a lone message, the producer waits for each
+//          one to arrive before sending the next
+//
+//   make bench && ./bench_ring -d /dev/pchar
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/types.h>
+
+// From hw7.c
+#define PCHAR_RING_WAIT_DATA  _IO('r', 1)
+#define PCHAR_RING_WAIT_SPACE _IO('r', 2)
+#define PCHAR_RING_KICK       _IO('r', 3)
+
+#define CACHE_BYTES 64  // SMP_CACHE_BYTES of the kernel the module runs on
+
+struct pchar_ring_ctrl {
+    __u32 head;
+    __u8 pad1[CACHE_BYTES - sizeof(__u32)];
+    __u32 tail;
+    __u8 pad2[CACHE_BYTES - sizeof(__u32)];
+    __u32 size;
+    __u32 rd_waiting;
+    __u32 wr_waiting;
+};
+
+#define LAT_MSGS 10000
+
+static const char *dev_path = "/dev/pchar";
+static double seconds = 1.0;
+static volatile int stop;
+
+// One producer/consumer pair over one path
+struct pair {
+    size_t size;                  // bytes per message
+    int ring;                     // shared ring instead of read/write
+    int lat;                      // latency run: one message in flight
+    int fd;                       // ring: the mapping's file, for the ioctls
+    struct pchar_ring_ctrl *ctrl;
+    char *data;
+    unsigned long long msgs;      // received
+    unsigned long long sent;
+    double lat_sum;               // seconds, latency runs
+    int err;
+};
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void wake_handler(int sig)
+{
+    (void)sig;
+}
+
+// Ring producer side: copy 'len' bytes in, sleeping in the driver while full
+static int ring_put(struct pair *p, const char *buf, size_t len)
+{
+    struct pchar_ring_ctrl *c = p->ctrl;
+    __u32 mask = c->size - 1;
+    __u32 head, tail, n, off, l;
+
+    while (len) {
+        head = c->head;
+        tail = __atomic_load_n(&c->tail, __ATOMIC_ACQUIRE);
+        n = c->size - (head - tail);
+        if (!n) {
+            if (stop)
+                return -1;
+            if (ioctl(p->fd, PCHAR_RING_WAIT_SPACE) < 0 && errno != EINTR)
+                return errno;
+            continue;
+        }
+        if (n > len)
+            n = len;
+        off = head & mask;
+        l = n < c->size - off ? n : c->size - off;
+        memcpy(p->data + off, buf, l);
+        memcpy(p->data, buf + l, n - l);
+        __atomic_store_n(&c->head, head + n, __ATOMIC_RELEASE);
+        // Index store before the flag load, pairs with the driver's smp_mb()
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (c->rd_waiting)
+            ioctl(p->fd, PCHAR_RING_KICK);
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Ring consumer side: copy 'len' bytes out, sleeping in the driver while empty
+static int ring_get(struct pair *p, char *buf, size_t len)
+{
+    struct pchar_ring_ctrl *c = p->ctrl;
+    __u32 mask = c->size - 1;
+    __u32 head, tail, n, off, l;
+
+    while (len) {
+        tail = c->tail;
+        head = __atomic_load_n(&c->head, __ATOMIC_ACQUIRE);
+        n = head - tail;
+        if (!n) {
+            if (stop)
+                return -1;
+            if (ioctl(p->fd, PCHAR_RING_WAIT_DATA) < 0 && errno != EINTR)
+                return errno;
+            continue;
+        }
+        if (n > len)
+            n = len;
+        off = tail & mask;
+        l = n < c->size - off ? n : c->size - off;
+        memcpy(buf, p->data + off, l);
+        memcpy(buf + l, p->data, n - l);
+        __atomic_store_n(&c->tail, tail + n, __ATOMIC_RELEASE);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (c->wr_waiting)
+            ioctl(p->fd, PCHAR_RING_KICK);
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// read/write path: move a whole message, resuming after short transfers
+static int fd_move(int fd, char *buf, size_t len, int out)
+{
+    ssize_t n;
+
+    while (len) {
+        n = out ? write(fd, buf, len) : read(fd, buf, len);
+        if (n <= 0) {
+            if (stop)
+                return -1;
+            if (n < 0 && errno != EINTR)
+                return errno;
+            continue;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void *producer_fn(void *arg)
+{
+    struct pair *p = arg;
+    char *buf = calloc(1, p->size);
+    double t;
+    int fd = -1;
+    int ret = 0;
+
+    if (!p->ring) {
+        fd = open(dev_path, O_WRONLY);
+        if (fd < 0) {
+            p->err = errno;
+            goto out;
+        }
+    }
+
+    while (!stop && (!p->lat || p->sent < LAT_MSGS)) {
+        t = now();
+        memcpy(buf, &t, sizeof(t));
+        ret = p->ring ? ring_put(p, buf, p->size) : fd_move(fd, buf, p->size, 1);
+        if (ret)
+            break;
+        p->sent++;
+        // Latency run: wait for the consumer, so the next message finds it idle
+        while (p->lat && !stop && __atomic_load_n(&p->msgs, __ATOMIC_ACQUIRE) < p->sent)
+            sched_yield();
+    }
+    if (ret > 0)
+        p->err = ret;
+out:
+    if (fd >= 0)
+        close(fd);
+    free(buf);
+    return NULL;
+}
+
+static void *consumer_fn(void *arg)
+{
+    struct pair *p = arg;
+    char *buf = malloc(p->size);
+    double t;
+    int fd = -1;
+    int ret = 0;
+
+    if (!p->ring) {
+        fd = open(dev_path, O_RDONLY);
+        if (fd < 0) {
+            p->err = errno;
+            goto out;
+        }
+    }
+
+    while (!stop) {
+        ret = p->ring ? ring_get(p, buf, p->size) : fd_move(fd, buf, p->size, 0);
+        if (ret)
+            break;
+        memcpy(&t, buf, sizeof(t));
+        p->lat_sum += now() - t;
+        __atomic_store_n(&p->msgs, p->msgs + 1, __ATOMIC_RELEASE);
+    }
+    if (ret > 0)
+        p->err = ret;
+out:
+    if (fd >= 0)
+        close(fd);
+    free(buf);
+    return NULL;
+}
+
+// Throw away what an earlier run left queued, possibly half a message
+static void drain(struct pair *p)
+{
+    char buf[4096];
+    int fd;
+
+    if (p->ring) {
+        p->ctrl->tail = p->ctrl->head;
+        return;
+    }
+    fd = open(dev_path, O_RDONLY | O_NONBLOCK);
+    if (fd < 0)
+        return;
+    while (read(fd, buf, sizeof(buf)) > 0)
+        ;
+    close(fd);
+}
+
+// One run, returns MB/s or microseconds per message, negative on failure
+static double run(struct pair *p)
+{
+    pthread_t prod, cons;
+    double start, elapsed;
+
+    drain(p);
+    stop = 0;
+    pthread_create(&cons, NULL, consumer_fn, p);
+    pthread_create(&prod, NULL, producer_fn, p);
+
+    start = now();
+    while (now() - start < seconds && (!p->lat || p->msgs < LAT_MSGS))
+        usleep(1000);
+    stop = 1;
+    elapsed = now() - start;
+
+    pthread_kill(prod, SIGUSR1);
+    pthread_kill(cons, SIGUSR1);
+    pthread_join(prod, NULL);
+    pthread_join(cons, NULL);
+
+    if (p->err) {
+        fprintf(stderr, "%s, %zu B: %s\n", p->ring ? "ring" : "read/write", p->size,
+                strerror(p->err));
+        return -1;
+    }
+    if (p->lat)
+        return p->msgs ? p->lat_sum / p->msgs * 1e6 : 0;
+    return p->msgs * p->size / elapsed / 1e6;
+}
+
+// Map the control page and the ring data behind it
+static int ring_map(struct pair *p)
+{
+    struct pchar_ring_ctrl *c;
+    long page = sysconf(_SC_PAGESIZE);
+    size_t size;
+
+    p->fd = open(dev_path, O_RDWR);
+    if (p->fd < 0)
+        return -1;
+    c = mmap(NULL, page, PROT_READ, MAP_SHARED, p->fd, 0);
+    if (c == MAP_FAILED)
+        return -1;
+    size = c->size;
+    munmap(c, page);
+
+    p->ctrl = mmap(NULL, page + size, PROT_READ | PROT_WRITE, MAP_SHARED, p->fd, 0);
+    if (p->ctrl == MAP_FAILED)
+        return -1;
+    p->data = (char *)p->ctrl + page;
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-d device] [-t seconds per run]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    struct sigaction sa = { .sa_handler = wake_handler };  // no SA_RESTART
+    static const size_t sizes[] = { 8, 64, 512, 4096, 32768 };
+    struct pair ring = {};
+    double res[4];
+    unsigned int i, j;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:t:")) != -1) {
+        switch (opt) {
+            case 'd':
+                dev_path = optarg;
+                break;
+            case 't':
+                seconds = atof(optarg);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (seconds <= 0)
+        usage(argv[0]);
+    sigaction(SIGUSR1, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    if (ring_map(&ring)) {
+        perror(dev_path);
+        return 1;
+    }
+
+    printf("%8s %12s %12s %12s %12s\n", "size", "ring_MB/s", "rw_MB/s", "ring_lat_us",
+           "rw_lat_us");
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        // j: bit 0 = read/write path, bit 1 = latency run
+        for (j = 0; j < 4; j++) {
+            struct pair p = ring;
+
+            p.size = sizes[i];
+            p.ring = !(j & 1);
+            p.lat = j >> 1;
+            res[j] = run(&p);
+            if (res[j] < 0)
+                return 1;
+        }
+        printf("%8zu %12.1f %12.1f %12.2f %12.2f\n", sizes[i], res[0], res[1], res[2], res[3]);
+    }
+    return 0;
+}
@@ -0,0 +1,285 @@
+// Userspace throughput benchmark for the pchar FIFO (hw7.c) read/write path.
+//
+// Writer threads and one reader thread stream through the device for a
+// fixed time per transfer size, 1 B to 1 MiB, and the bytes the reader got
+// are reported as MB/s and syscalls per second. With a slowed down reader
+// (-s) the writers outrun it: the CPU they burn shows whether they sleep on
+// a full FIFO or spin, and the fairness column is the smallest writer's
+// share of bytes over the largest one's. With -S the transfer size is
+// fixed and the writer count goes 1, 2, 4, ... up to -w instead, next to
+// the linear scaling of the one-writer figure; on a sharded hw7.c
+// (sharded=1) the writers no longer share one lock and should keep up.
+//
+//   make bench && ./bench_rw -d /dev/pchar -t 1
+//   ./bench_rw -w 4 -s 100      # 4 writers, reader pauses 100 us per read
+//   ./bench_rw -w 16 -S 4096    # writer scaling with 4 KiB writes
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_SIZE (1024 * 1024)
+#define MAX_WRITERS 64
+
+static const char *dev_path = "/dev/pchar";
+static double seconds = 1.0;
+static unsigned int writers = 1;
+static unsigned int read_delay_us;
+static size_t sweep_size;  // -S: scale writers at this size instead of sizes
+static volatile int stop;
+
+struct worker {
+    pthread_t thread;
+    size_t size;            // bytes per read or write call
+    unsigned long long bytes;
+    unsigned long long calls;
+    int err;                // errno of the first unexpected failure
+    double cpu;             // thread CPU seconds
+};
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double thread_cpu(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Lets pthread_kill interrupt a write blocked in the driver
+static void wake_handler(int sig)
+{
+    (void)sig;
+}
+
+static void *writer_fn(void *arg)
+{
+    struct worker *w = arg;
+    char *buf = malloc(w->size);
+    ssize_t n;
+    int fd;
+
+    fd = open(dev_path, O_WRONLY);
+    if (fd < 0 || !buf) {
+        w->err = errno;
+        goto out;
+    }
+    memset(buf, 'w', w->size);
+
+    while (!stop) {
+        n = write(fd, buf, w->size);
+        if (n < 0) {
+            if (errno != EINTR && !stop)
+                w->err = errno;
+            break;
+        }
+        w->bytes += n;
+        w->calls++;
+    }
+out:
+    w->cpu = thread_cpu();
+    if (fd >= 0)
+        close(fd);
+    free(buf);
+    return NULL;
+}
+
+// Non-blocking, so an empty FIFO cannot hold the reader past 'stop' even if
+// the signal lands between the check and the read
+static void *reader_fn(void *arg)
+{
+    struct worker *w = arg;
+    char *buf = malloc(w->size);
+    struct pollfd pfd = { .events = POLLIN };
+    ssize_t n;
+    int fd;
+
+    fd = open(dev_path, O_RDONLY | O_NONBLOCK);
+    if (fd < 0 || !buf) {
+        w->err = errno;
+        goto out;
+    }
+    pfd.fd = fd;
+
+    while (!stop) {
+        n = read(fd, buf, w->size);
+        if (n < 0 && errno == EAGAIN) {
+            poll(&pfd, 1, 100);
+            continue;
+        }
+        if (n < 0) {
+            if (errno != EINTR && !stop)
+                w->err = errno;
+            break;
+        }
+        w->bytes += n;
+        w->calls++;
+        if (read_delay_us)
+            usleep(read_delay_us);
+    }
+out:
+    if (fd >= 0)
+        close(fd);
+    free(buf);
+    return NULL;
+}
+
+// Throw away what an earlier run left queued, so each size starts empty
+static void drain(void)
+{
+    char buf[65536];
+    int fd = open(dev_path, O_RDONLY | O_NONBLOCK);
+
+    if (fd < 0)
+        return;
+    while (read(fd, buf, sizeof(buf)) > 0)
+        ;
+    close(fd);
+}
+
+// What one run measured
+struct result {
+    double mbs, writes, reads;  // per second
+    double wr_cpu;              // writer CPU, percent of one CPU
+    double fair;                // least writer bytes / most writer bytes
+};
+
+// Stream for 'seconds' with 'nwriters' writers and 'size' byte calls,
+// return 0 or an errno
+static int run(size_t size, unsigned int nwriters, struct result *res)
+{
+    struct worker wr[MAX_WRITERS] = {}, rd = { .size = size };
+    unsigned long long wr_calls = 0, least = ~0ULL, most = 0;
+    double start, elapsed, wr_cpu = 0;
+    unsigned int i;
+    int err = 0;
+
+    drain();
+    stop = 0;
+    pthread_create(&rd.thread, NULL, reader_fn, &rd);
+    for (i = 0; i < nwriters; i++) {
+        wr[i].size = size;
+        pthread_create(&wr[i].thread, NULL, writer_fn, &wr[i]);
+    }
+
+    start = now();
+    usleep(seconds * 1e6);
+    stop = 1;
+    elapsed = now() - start;
+
+    // Writers block, so hw7.c queues them in order; kick them out of a full
+    // FIFO, again if one checked 'stop' just before the signal landed
+    for (i = 0; i < nwriters; i++) {
+        while (pthread_tryjoin_np(wr[i].thread, NULL)) {
+            pthread_kill(wr[i].thread, SIGUSR1);
+            usleep(1000);
+        }
+        if (!err)
+            err = wr[i].err;
+        wr_calls += wr[i].calls;
+        wr_cpu += wr[i].cpu;
+        if (wr[i].bytes < least)
+            least = wr[i].bytes;
+        if (wr[i].bytes > most)
+            most = wr[i].bytes;
+    }
+    pthread_join(rd.thread, NULL);
+    if (!err)
+        err = rd.err;
+
+    if (err) {
+        fprintf(stderr, "%zu B, %u writers: %s\n", size, nwriters, strerror(err));
+        return err;
+    }
+    res->mbs = rd.bytes / elapsed / 1e6;
+    res->writes = wr_calls / elapsed;
+    res->reads = rd.calls / elapsed;
+    res->wr_cpu = wr_cpu / elapsed * 100;
+    res->fair = most ? (double)least / most : 1.0;
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-d device] [-t seconds per size] [-w writers] "
+            "[-s reader pause us] [-S size: sweep writers up to -w]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    struct sigaction sa = { .sa_handler = wake_handler };  // no SA_RESTART
+    struct result res;
+    double one = 0;
+    unsigned int n;
+    size_t size;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:t:w:s:S:")) != -1) {
+        switch (opt) {
+            case 'd':
+                dev_path = optarg;
+                break;
+            case 't':
+                seconds = atof(optarg);
+                break;
+            case 'w':
+                writers = atoi(optarg);
+                break;
+            case 's':
+                read_delay_us = atoi(optarg);
+                break;
+            case 'S':
+                sweep_size = atol(optarg);
+                if (!sweep_size || sweep_size > MAX_SIZE)
+                    usage(argv[0]);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (seconds <= 0 || !writers || writers > MAX_WRITERS)
+        usage(argv[0]);
+    sigaction(SIGUSR1, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);  // a pipe or socket given as -d may lose its reader first
+
+    if (sweep_size) {
+        printf("%8s %12s %12s %12s %8s %6s\n", "writers", "MB/s", "linear_MB/s", "writes/s",
+               "wr_cpu%", "fair");
+        for (n = 1;; n = n * 2 < writers ? n * 2 : writers) {
+            if (run(sweep_size, n, &res))
+                return 1;
+            if (n == 1)
+                one = res.mbs;
+            printf("%8u %12.1f %12.1f %12.0f %8.0f %6.2f\n", n, res.mbs, one * n,
+                   res.writes, res.wr_cpu, res.fair);
+            if (n == writers)
+                break;
+        }
+        return 0;
+    }
+
+    printf("%8s %12s %12s %12s %8s %6s\n", "size", "MB/s", "writes/s", "reads/s",
+           "wr_cpu%", "fair");
+    for (size = 1; size <= MAX_SIZE; size *= 4) {
+        if (run(size, writers, &res))
+            return 1;
+        printf("%8zu %12.1f %12.0f %12.0f %8.0f %6.2f\n", size, res.mbs, res.writes,
+               res.reads, res.wr_cpu, res.fair);
+    }
+    return 0;
+}
@@ -0,0 +1,237 @@
+// Userspace benchmark: splice/sendfile out of a FIFO device against read+write.
+//
+// A producer thread keeps the device full. The consumer moves its data into
+// an output file three ways, for a fixed time each and per chunk size:
+//   rw        read() into a user buffer, write() to the file
+//   splice    splice() device -> pipe -> file, no user copy
+//   sendfile  sendfile() device -> file
+// With -S the producer fills the device with splice() from a pipe as well,
+// exercising .splice_write. Works on /dev/pchar (hw7.c) and /dev/pseudoN (hw.c).
+//
+//   make bench && ./bench_splice -d /dev/pchar -o /tmp/out
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <time.h>
+#include <unistd.h>
+
+enum method { RW, SPLICE, SENDFILE, METHODS };
+static const char * const method_names[] = { "rw", "splice", "sendfile" };
+
+static const char *dev_path = "/dev/pchar";
+static const char *out_path = "/dev/null";
+static double seconds = 1.0;
+static int splice_in;
+static volatile int stop;
+
+struct consumer {
+    enum method method;
+    size_t chunk;
+    unsigned long long bytes;
+    int err;
+};
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void wake_handler(int sig)
+{
+    (void)sig;
+}
+
+// Keep the device full, with write() or with splice() from a pipe
+static void *producer_fn(void *arg)
+{
+    size_t chunk = *(size_t *)arg;
+    char *buf = malloc(chunk);
+    int pfd[2] = { -1, -1 };
+    ssize_t n;
+    int fd;
+
+    fd = open(dev_path, O_WRONLY);
+    if (fd < 0 || !buf || (splice_in && pipe(pfd)))
+        goto out;
+    memset(buf, 'p', chunk);
+    // A pipe write larger than the pipe would block with nobody to drain it
+    if (splice_in) {
+        n = fcntl(pfd[1], F_SETPIPE_SZ, chunk);
+        if (n > 0 && (size_t)n < chunk)
+            chunk = n;
+        else if (n < 0)
+            chunk = 65536;
+    }
+
+    while (!stop) {
+        if (splice_in) {
+            // Refill the pipe, then hand its pages to the device
+            n = write(pfd[1], buf, chunk);
+            if (n > 0)
+                n = splice(pfd[0], NULL, fd, NULL, n, SPLICE_F_MOVE);
+        } else {
+            n = write(fd, buf, chunk);
+        }
+        if (n < 0)
+            break;
+    }
+out:
+    if (pfd[0] >= 0) {
+        close(pfd[0]);
+        close(pfd[1]);
+    }
+    if (fd >= 0)
+        close(fd);
+    free(buf);
+    return NULL;
+}
+
+static void *consumer_fn(void *arg)
+{
+    struct consumer *c = arg;
+    char *buf = malloc(c->chunk);
+    int pfd[2] = { -1, -1 };
+    int fd, out = -1;
+    ssize_t n, m, done;
+
+    fd = open(dev_path, O_RDONLY);
+    if (fd >= 0)
+        out = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || out < 0 || !buf || (c->method == SPLICE && pipe(pfd))) {
+        c->err = errno;
+        goto out;
+    }
+
+    while (!stop) {
+        switch (c->method) {
+            case RW:
+                n = read(fd, buf, c->chunk);
+                m = n > 0 ? write(out, buf, n) : n;
+                break;
+            case SPLICE:
+                n = splice(fd, NULL, pfd[1], NULL, c->chunk, SPLICE_F_MOVE);
+                // Empty the pipe before the next pass
+                for (m = 0, done = 0; n > 0 && done < n && m >= 0; done += m)
+                    m = splice(pfd[0], NULL, out, NULL, n - done, SPLICE_F_MOVE);
+                break;
+            default:
+                n = m = sendfile(out, fd, NULL, c->chunk);
+                break;
+        }
+        if (n < 0 || m < 0) {
+            if (errno != EINTR && !stop)
+                c->err = errno;
+            break;
+        }
+        c->bytes += n;
+        // Keep a regular output file from growing without bound
+        if (c->bytes % (1 << 30) < (unsigned long long)n)
+            lseek(out, 0, SEEK_SET);
+    }
+out:
+    if (pfd[0] >= 0) {
+        close(pfd[0]);
+        close(pfd[1]);
+    }
+    if (out >= 0)
+        close(out);
+    if (fd >= 0)
+        close(fd);
+    free(buf);
+    return NULL;
+}
+
+// One timed run, returns MB/s or a negative value on failure
+static double run(enum method method, size_t chunk)
+{
+    struct consumer c = { .method = method, .chunk = chunk };
+    pthread_t prod, cons;
+    double start, elapsed;
+
+    stop = 0;
+    pthread_create(&cons, NULL, consumer_fn, &c);
+    pthread_create(&prod, NULL, producer_fn, &chunk);
+
+    start = now();
+    usleep(seconds * 1e6);
+    stop = 1;
+    elapsed = now() - start;
+
+    pthread_kill(prod, SIGUSR1);
+    pthread_kill(cons, SIGUSR1);
+    pthread_join(prod, NULL);
+    pthread_join(cons, NULL);
+
+    if (c.err) {
+        fprintf(stderr, "%s, %zu B: %s\n", method_names[method], chunk, strerror(c.err));
+        return -1;
+    }
+    return c.bytes / elapsed / 1e6;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-d device] [-o output file] [-t seconds per run] [-S]\n",
+            prog);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    struct sigaction sa = { .sa_handler = wake_handler };  // no SA_RESTART
+    size_t chunk;
+    double mbs;
+    int method;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:o:t:S")) != -1) {
+        switch (opt) {
+            case 'd':
+                dev_path = optarg;
+                break;
+            case 'o':
+                out_path = optarg;
+                break;
+            case 't':
+                seconds = atof(optarg);
+                break;
+            case 'S':
+                splice_in = 1;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (seconds <= 0)
+        usage(argv[0]);
+    sigaction(SIGUSR1, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("%8s", "chunk");
+    for (method = 0; method < METHODS; method++)
+        printf(" %10s_MB/s", method_names[method]);
+    printf("\n");
+    for (chunk = 4096; chunk <= 1024 * 1024; chunk *= 4) {
+        printf("%8zu", chunk);
+        for (method = 0; method < METHODS; method++) {
+            // A method the device does not support shows as n/a, the rest still run
+            mbs = run(method, chunk);
+            if (mbs < 0)
+                printf(" %15s", "n/a");
+            else
+                printf(" %15.1f", mbs);
+            fflush(stdout);
+        }
+        printf("\n");
+    }
+    return 0;
+}
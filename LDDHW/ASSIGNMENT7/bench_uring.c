@@ -0,0 +1,272 @@
+// Userspace benchmark: io_uring queue depth scaling on the hw72.c buffer.
+//
+// Keeps QD random -s byte reads in flight with IORING_OP_READ, for QD = 1,
+// 2, 4, ... up to -q, and prints completions per second next to plain
+// pread() at the top. The driver sets FMODE_NOWAIT and honours IOCB_NOWAIT,
+// so reads are issued inline instead of being punted to io-wq workers.
+// Talks to the kernel through the raw syscalls, no liburing needed.
+//
+//   insmod hw72.ko shared=1 buf_size=16777216
+//   make bench && ./bench_uring -d /dev/pchar -q 64
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+
+#define MAX_QD 1024
+
+static const char *dev_path = "/dev/pchar";
+static unsigned int max_qd = 64;
+static size_t block = 4096;
+static double seconds = 1.0;
+
+// The parts of one ring the benchmark touches
+struct ring {
+    int fd;
+    unsigned int *sq_tail, *sq_mask, *sq_array;
+    unsigned int *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq, *cq;
+    size_t sq_size, cq_size, sqes_size;
+};
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned long long next_rand(unsigned long long *s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+static int ring_setup(struct ring *r, unsigned int entries)
+{
+    struct io_uring_params p = {};
+    size_t sq_size, cq_size;
+    char *sq, *cq;
+
+    r->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0)
+        return -1;
+
+    sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        sq_size = cq_size = sq_size > cq_size ? sq_size : cq_size;
+
+    sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+              IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED)
+        return -1;
+    cq = sq;
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+                  IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED)
+            return -1;
+    }
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED)
+        return -1;
+    r->sq = sq;
+    r->cq = cq;
+    r->sq_size = sq_size;
+    r->cq_size = cq_size;
+
+    r->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned int *)(sq + p.sq_off.array);
+    r->cq_head = (unsigned int *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+}
+
+static void ring_exit(struct ring *r)
+{
+    munmap(r->sqes, r->sqes_size);
+    if (r->cq != r->sq)
+        munmap(r->cq, r->cq_size);
+    munmap(r->sq, r->sq_size);
+    close(r->fd);
+}
+
+// Queue a read of 'block' bytes at a random offset into slot 'slot'
+static void queue_read(struct ring *r, int fd, char *bufs, unsigned int slot, off_t blocks,
+                       unsigned long long *seed)
+{
+    unsigned int tail = *r->sq_tail, idx = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)(bufs + slot * block);
+    sqe->len = block;
+    sqe->off = (next_rand(seed) % blocks) * block;
+    sqe->user_data = slot;
+    r->sq_array[idx] = idx;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+// Keep 'qd' reads in flight for 'seconds'; returns completions per second or -1
+static double run_uring(int fd, off_t size, unsigned int qd)
+{
+    unsigned long long seed = 0x9e3779b97f4a7c15ULL, done = 0;
+    off_t blocks = size / block;
+    struct ring r;
+    unsigned int head, tail, i, submit = qd;
+    struct io_uring_cqe *cqe;
+    double start, elapsed = 0;
+    char *bufs;
+    int err = 0;
+
+    bufs = malloc(qd * block);
+    if (!bufs || ring_setup(&r, qd)) {
+        perror("io_uring_setup");
+        free(bufs);
+        return -1;
+    }
+
+    for (i = 0; i < qd; i++)
+        queue_read(&r, fd, bufs, i, blocks, &seed);
+
+    start = now();
+    do {
+        // Submit the refills and wait for at least one completion
+        if (syscall(__NR_io_uring_enter, r.fd, submit, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0
+            && errno != EINTR) {
+            err = errno;
+            break;
+        }
+        // Reap everything that completed and put a new read in each slot
+        submit = 0;
+        head = *r.cq_head;
+        tail = __atomic_load_n(r.cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            cqe = &r.cqes[head & *r.cq_mask];
+            if (cqe->res < 0) {
+                err = -cqe->res;
+                break;
+            }
+            queue_read(&r, fd, bufs, cqe->user_data, blocks, &seed);
+            submit++;
+            done++;
+        }
+        __atomic_store_n(r.cq_head, head, __ATOMIC_RELEASE);
+        elapsed = now() - start;
+    } while (!err && elapsed < seconds);
+
+    ring_exit(&r);
+    free(bufs);
+    if (err) {
+        fprintf(stderr, "io_uring read: %s\n", strerror(err));
+        return -1;
+    }
+    return done / elapsed;
+}
+
+// Synchronous baseline: one pread() at a time
+static double run_pread(int fd, off_t size)
+{
+    unsigned long long seed = 0x9e3779b97f4a7c15ULL, done = 0;
+    off_t blocks = size / block;
+    char *buf = malloc(block);
+    double start = now(), elapsed;
+
+    if (!buf)
+        return -1;
+    do {
+        if (pread(fd, buf, block, (next_rand(&seed) % blocks) * block) < 0) {
+            perror("pread");
+            free(buf);
+            return -1;
+        }
+        done++;
+        elapsed = now() - start;
+    } while (elapsed < seconds);
+    free(buf);
+    return done / elapsed;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-d device] [-q max queue depth] [-s bytes per read] "
+            "[-t seconds per step]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    double ops;
+    unsigned int qd;
+    off_t size;
+    int opt, fd;
+
+    while ((opt = getopt(argc, argv, "d:q:s:t:")) != -1) {
+        switch (opt) {
+            case 'd':
+                dev_path = optarg;
+                break;
+            case 'q':
+                max_qd = atoi(optarg);
+                break;
+            case 's':
+                block = atol(optarg);
+                break;
+            case 't':
+                seconds = atof(optarg);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (!max_qd || max_qd > MAX_QD || !block || seconds <= 0)
+        usage(argv[0]);
+
+    fd = open(dev_path, O_RDONLY);
+    if (fd < 0) {
+        perror(dev_path);
+        return 1;
+    }
+    // The driver's llseek reports the buffer size at SEEK_END
+    size = lseek(fd, 0, SEEK_END);
+    if (size < (off_t)block) {
+        fprintf(stderr, "%s: buffer smaller than one read\n", dev_path);
+        return 1;
+    }
+
+    printf("%8s %14s %12s\n", "qd", "ops/s", "MB/s");
+    ops = run_pread(fd, size);
+    if (ops < 0)
+        return 1;
+    printf("%8s %14.0f %12.1f\n", "pread", ops, ops * block / 1e6);
+    for (qd = 1;; qd = qd * 2 < max_qd ? qd * 2 : max_qd) {
+        ops = run_uring(fd, size, qd);
+        if (ops < 0)
+            return 1;
+        printf("%8u %14.0f %12.1f\n", qd, ops, ops * block / 1e6);
+        if (qd == max_qd)
+            break;
+    }
+    close(fd);
+    return 0;
+}
@@ -5,46 +5,360 @@
 #include <linux/uaccess.h>
 #include <linux/wait.h>
 #include <linux/kfifo.h>
+#include <linux/mutex.h>
+#include <linux/poll.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/log2.h>
+#include <linux/ktime.h>
+#include <linux/uio.h>
+#include <linux/splice.h>
+#include <linux/percpu.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/cpumask.h>
+#include <linux/topology.h>
+
+#define CREATE_TRACE_POINTS
+#include "hw7_trace.h"
 
 #define DEVICE_NAME "pchar"  // Device name for our char driver
-#define FIFO_SIZE 1024      // FIFO size for buffer
+#define FIFO_MIN_SIZE 1024  // smallest FIFO or shard
+
+// ioctl commands for the mmap'ed ring (see struct pchar_ring_ctrl)
+#define PCHAR_RING_WAIT_DATA  _IO('r', 1)   // sleep until head != tail
+#define PCHAR_RING_WAIT_SPACE _IO('r', 2)   // sleep until head - tail < size
+#define PCHAR_RING_KICK       _IO('r', 3)   // wake sleepers after moving head/tail
+
+// ioctl commands for message mode (see struct pchar_msg_batch)
+#define PCHAR_SET_MSG_MODE    _IOW('r', 4, __u32)
+#define PCHAR_ENQ_BATCH       _IOWR('r', 5, struct pchar_msg_batch)
+#define PCHAR_DEQ_BATCH       _IOWR('r', 6, struct pchar_msg_batch)
+
+// ioctl command for queueing delay tracking (see struct pchar_sojourn_cfg)
+#define PCHAR_SET_SOJOURN     _IOW('r', 7, struct pchar_sojourn_cfg)
+
+// Message mode records: 16-bit length header then payload, as kfifo_rec_ptr_2
+#define PCHAR_REC_HDR 2
+#define PCHAR_REC_MAX min_t(unsigned int, fifo_size - PCHAR_REC_HDR, U16_MAX)
+
+// Batch of messages for PCHAR_ENQ_BATCH/PCHAR_DEQ_BATCH. Dequeue stores the
+// length of each received message back into its iov_len.
+struct pchar_msg_batch {
+    __u64 iov;    // user pointer to struct iovec[count]
+    __u32 count;  // messages to move
+    __u32 done;   // out: messages moved
+};
+
+// Queueing delay tracking settings, passed with PCHAR_SET_SOJOURN
+struct pchar_sojourn_cfg {
+    __u32 enable;       // timestamp writes and keep a sojourn-time histogram
+    __u32 target_us;    // 0 = no target; otherwise flag the producer above it
+    __u32 interval_us;  // how long the delay must stay above target first
+    __u32 reject;       // 1 = writes fail with -ENOBUFS while above target
+};
 
-// FIFO buffer
-static DECLARE_KFIFO(my_fifo, char, FIFO_SIZE);
+/*
+ * Shared ring layout: page 0 of the mapping is this control block, the
+ * data area (ring_size bytes) starts at page 1. head and tail are free
+ * running indices masked with size - 1; the producer only stores head,
+ * the consumer only stores tail. The kernel sets rd_waiting/wr_waiting
+ * before a consumer/producer sleeps; a side that moved an index, issued a
+ * full barrier and sees the other side's flag calls PCHAR_RING_KICK,
+ * otherwise no syscall is needed. One producer and one consumer, like kfifo.
+ */
+struct pchar_ring_ctrl {
+    __u32 head;
+    __u8 pad1[SMP_CACHE_BYTES - sizeof(__u32)];
+    __u32 tail;
+    __u8 pad2[SMP_CACHE_BYTES - sizeof(__u32)];
+    __u32 size;
+    __u32 rd_waiting;
+    __u32 wr_waiting;
+};
+
+// Bytes in my_fifo, rounded up to a power of two. The buffer comes from
+// kvmalloc, so large sizes fall back to vmalloc instead of high-order pages.
+static unsigned int fifo_size = 64 * 1024;
+module_param(fifo_size, uint, 0444);
+MODULE_PARM_DESC(fifo_size, "Bytes in the FIFO");
+
+// Size of the mmap'ed ring data area, rounded up to a power of two
+static unsigned int ring_size = 64 * 1024;
+module_param(ring_size, uint, 0444);
+MODULE_PARM_DESC(ring_size, "Bytes in the mmap-able shared ring");
+
+/*
+ * Multi-producer mode: instead of my_fifo, one single-producer ring per CPU.
+ * A writer fills the shard of the CPU it runs on and never takes wr_lock; the
+ * shard's own mutex is only contended by tasks preempted on the same CPU. The
+ * reader drains the shards round-robin. A write picks its shard once and
+ * stays on it even if the task migrates while waiting for space, so one
+ * write's bytes are never split across shards and read back out of order.
+ * Writes up to shard_size also go in whole; larger ones may interleave with
+ * other writers of the same shard, as pipe writes larger than PIPE_BUF do.
+ */
+static bool sharded;
+module_param(sharded, bool, 0444);
+MODULE_PARM_DESC(sharded, "Give each CPU its own FIFO shard for concurrent writers");
+
+// Bytes per shard, rounded up to a power of two
+static unsigned int shard_size = 4 * FIFO_MIN_SIZE;
+module_param(shard_size, uint, 0444);
+MODULE_PARM_DESC(shard_size, "Bytes in each per-CPU FIFO shard (sharded mode)");
+
+struct pchar_shard {
+    struct mutex lock;   // writers on this CPU; 'head' only moves under it
+    char *buf;           // shard_size bytes on the CPU's node
+    unsigned int head;   // free running, as kfifo 'in'
+    unsigned int tail ____cacheline_aligned_in_smp;  // as kfifo 'out', moved under rd_lock
+};
+static DEFINE_PER_CPU_ALIGNED(struct pchar_shard, pchar_shards);
+static unsigned int shard_next;  // shard the next read starts at (rd_lock)
+
+// Per-CPU transfer counters, summed in /sys/kernel/debug/pchar/stats
+struct pchar_stats {
+    u64 rd_bytes, wr_bytes;
+    u64 rd_ops, wr_ops;
+    u64 waits;  // times a reader or writer had to sleep
+    u64 fails;  // calls that returned an error other than -EAGAIN
+};
+static DEFINE_PER_CPU(struct pchar_stats, pchar_stats);
+static struct dentry *pchar_debugfs;
+
+// Enqueue timestamps: one per write, popped once the reader has passed 'end'
+#define PCHAR_STAMPS 256          // power of two
+#define PCHAR_SOJOURN_BUCKETS 24  // bucket i counts delays in [2^i, 2^(i+1)) us
+
+struct pchar_stamp {
+    u64 ts;            // ktime_get_ns() at enqueue
+    unsigned int end;  // my_fifo 'in' index after the write
+};
+
+// Queueing delay state, allocated while tracking is enabled. The stamp ring
+// is single producer (wr_lock) / single consumer (rd_lock) like the kfifo.
+struct pchar_sojourn {
+    u64 target_ns, interval_ns;
+    bool reject;
+    u64 above_since;    // when the delay went above target, 0 while below
+    unsigned int head, tail;
+    struct pchar_stamp stamps[PCHAR_STAMPS];
+    u64 hist[PCHAR_SOJOURN_BUCKETS];
+};
+
+// Per-open state
+struct pchar_file {
+    bool ring_mapped;  // file mapped the shared ring, poll reports its state
+};
+
+// FIFO over fifo_buf, which holds fifo_size bytes
+static DECLARE_KFIFO_PTR(my_fifo, char);
+static char *fifo_buf;
 
 // Waiting queue for readers
 static wait_queue_head_t rd_wq;
 
+// Waiting queue for writers, woken by readers after draining
+static wait_queue_head_t wr_wq;
+
+// Processes registered for SIGIO via fcntl(F_SETFL, O_ASYNC)
+static struct fasync_struct *async_queue;
+
+// kfifo is lock-free for one reader and one writer only, so serialize each side
+static DEFINE_MUTEX(rd_lock);
+static DEFINE_MUTEX(wr_lock);
+
+// A writer waiting for FIFO space. Waiters are served in arrival order: only
+// the one at wr_head may write, and writers that arrive while others wait
+// queue up behind them, so a stream of small writes cannot keep a large
+// atomic one out forever.
+struct pchar_writer {
+    struct list_head node;
+};
+static LIST_HEAD(wr_queue);           // under wr_lock
+static struct pchar_writer *wr_head;  // first of wr_queue, also read by sleepers
+
+// Message mode: my_fifo holds length-prefixed records instead of a byte stream
+static bool msg_mode;
+static atomic_t open_count = ATOMIC_INIT(0);
+
+// Queueing delay tracking: NULL unless enabled, swapped under rd_lock and wr_lock
+static struct pchar_sojourn *sojourn;
+static bool over_target;  // queueing delay stayed above target for an interval
+
+// Shared ring: control page followed by the data area
+static void *ring_mem;
+static struct pchar_ring_ctrl *ring_ctrl;
+static wait_queue_head_t ring_wq;
+
 // Major number for the device
 static int major_num;
 
 // File operations for our device
-static ssize_t pchar_read(struct file *file, char __user *buf, size_t count, loff_t *pos);
-static ssize_t pchar_write(struct file *file, const char __user *buf, size_t count, loff_t *pos);
+static ssize_t pchar_read_iter(struct kiocb *iocb, struct iov_iter *to);
+static ssize_t pchar_write_iter(struct kiocb *iocb, struct iov_iter *from);
 static int pchar_open(struct inode *inode, struct file *file);
 static int pchar_release(struct inode *inode, struct file *file);
+static __poll_t pchar_poll(struct file *file, poll_table *wait);
+static int pchar_fasync(int fd, struct file *file, int on);
+static long pchar_ioctl(struct file *file, unsigned int cmd, unsigned long arg);
+static int pchar_mmap(struct file *file, struct vm_area_struct *vma);
+static bool pchar_is_empty(void);
+static bool pchar_has_space(void);
 
 static const struct file_operations fops = {
     .owner = THIS_MODULE,
-    .read = pchar_read,
-    .write = pchar_write,
+    .read_iter = pchar_read_iter,
+    .write_iter = pchar_write_iter,
+    .splice_read = generic_file_splice_read,   // FIFO -> pipe pages via read_iter
+    .splice_write = iter_file_splice_write,    // pipe pages -> FIFO via write_iter
     .open = pchar_open,
     .release = pchar_release,
+    .poll = pchar_poll,
+    .fasync = pchar_fasync,
+    .unlocked_ioctl = pchar_ioctl,
+    .mmap = pchar_mmap,
 };
 
+// debugfs: sum the per-CPU counters
+static int pchar_stats_show(struct seq_file *m, void *v)
+{
+    struct pchar_stats sum = {};
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        struct pchar_stats *st = per_cpu_ptr(&pchar_stats, cpu);
+
+        sum.rd_bytes += st->rd_bytes;
+        sum.wr_bytes += st->wr_bytes;
+        sum.rd_ops += st->rd_ops;
+        sum.wr_ops += st->wr_ops;
+        sum.waits += st->waits;
+        sum.fails += st->fails;
+    }
+    seq_printf(m, "rd_bytes=%llu wr_bytes=%llu rd_ops=%llu wr_ops=%llu waits=%llu fails=%llu\n",
+               sum.rd_bytes, sum.wr_bytes, sum.rd_ops, sum.wr_ops, sum.waits, sum.fails);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(pchar_stats);
+
+// debugfs: sojourn-time histogram and target state
+static int pchar_sojourn_show(struct seq_file *m, void *v)
+{
+    struct pchar_sojourn *sj;
+    int i;
+
+    if (mutex_lock_interruptible(&rd_lock))
+        return -ERESTARTSYS;
+    sj = sojourn;
+    if (!sj) {
+        seq_puts(m, "disabled\n");
+    } else {
+        seq_printf(m, "target_us=%llu interval_us=%llu reject=%d over_target=%d\n",
+                   sj->target_ns / NSEC_PER_USEC, sj->interval_ns / NSEC_PER_USEC,
+                   sj->reject, over_target);
+        for (i = 0; i < PCHAR_SOJOURN_BUCKETS; i++)
+            seq_printf(m, "%s%10lu us: %llu\n", i == PCHAR_SOJOURN_BUCKETS - 1 ? ">=" : "< ",
+                       i == PCHAR_SOJOURN_BUCKETS - 1 ? 1UL << i : 2UL << i, sj->hist[i]);
+    }
+    mutex_unlock(&rd_lock);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(pchar_sojourn);
+
+// debugfs: bytes queued in each shard
+static int pchar_shards_show(struct seq_file *m, void *v)
+{
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        struct pchar_shard *sh = per_cpu_ptr(&pchar_shards, cpu);
+
+        seq_printf(m, "cpu%d: queued=%u\n", cpu, READ_ONCE(sh->head) - READ_ONCE(sh->tail));
+    }
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(pchar_shards);
+
+static void pchar_shards_free(void)
+{
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        kvfree(per_cpu_ptr(&pchar_shards, cpu)->buf);
+        per_cpu_ptr(&pchar_shards, cpu)->buf = NULL;
+    }
+}
+
+// Allocate every possible CPU's shard on that CPU's memory node
+static int pchar_shards_alloc(void)
+{
+    struct pchar_shard *sh;
+    int cpu;
+
+    shard_size = roundup_pow_of_two(max(shard_size, (unsigned int)FIFO_MIN_SIZE));
+    for_each_possible_cpu(cpu) {
+        sh = per_cpu_ptr(&pchar_shards, cpu);
+        mutex_init(&sh->lock);
+        sh->buf = kvmalloc_node(shard_size, GFP_KERNEL, cpu_to_node(cpu));
+        if (!sh->buf) {
+            pchar_shards_free();
+            return -ENOMEM;
+        }
+    }
+    return 0;
+}
+
 // Module initialization function
 static int __init pchar_init(void)
 {
     // Initialize the FIFO and waiting queue
+    fifo_size = roundup_pow_of_two(clamp(fifo_size, (unsigned int)FIFO_MIN_SIZE, 1U << 30));
+    fifo_buf = kvmalloc(fifo_size, GFP_KERNEL);
+    if (!fifo_buf) {
+        printk(KERN_ALERT "pchar: Failed to allocate the FIFO\n");
+        return -ENOMEM;
+    }
+    kfifo_init(&my_fifo, fifo_buf, fifo_size);
     init_waitqueue_head(&rd_wq);
+    init_waitqueue_head(&wr_wq);
+    init_waitqueue_head(&ring_wq);
+
+    // Allocate the shared ring; vmalloc_user memory is zeroed and mappable
+    ring_size = roundup_pow_of_two(max(ring_size, (unsigned int)PAGE_SIZE));
+    ring_mem = vmalloc_user(PAGE_SIZE + ring_size);
+    if (!ring_mem) {
+        printk(KERN_ALERT "pchar: Failed to allocate the shared ring\n");
+        kvfree(fifo_buf);
+        return -ENOMEM;
+    }
+    ring_ctrl = ring_mem;
+    ring_ctrl->size = ring_size;
+
+    if (sharded && pchar_shards_alloc()) {
+        printk(KERN_ALERT "pchar: Failed to allocate the FIFO shards\n");
+        vfree(ring_mem);
+        kvfree(fifo_buf);
+        return -ENOMEM;
+    }
 
     // Register the character device
     major_num = register_chrdev(0, DEVICE_NAME, &fops);
     if (major_num < 0) {
         printk(KERN_ALERT "pchar: Failed to register a major number\n");
+        pchar_shards_free();
+        vfree(ring_mem);
+        kvfree(fifo_buf);
         return major_num;
     }
 
+    pchar_debugfs = debugfs_create_dir(DEVICE_NAME, NULL);
+    debugfs_create_file("stats", 0444, pchar_debugfs, NULL, &pchar_stats_fops);
+    debugfs_create_file("sojourn", 0444, pchar_debugfs, NULL, &pchar_sojourn_fops);
+    if (sharded)
+        debugfs_create_file("shards", 0444, pchar_debugfs, NULL, &pchar_shards_fops);
+
     printk(KERN_INFO "pchar: Registered with major number %d\n", major_num);
     return 0;
 }
@@ -53,75 +367,826 @@ static int __init pchar_init(void)
 static void __exit pchar_exit(void)
 {
     // Unregister the character device
+    debugfs_remove_recursive(pchar_debugfs);
     unregister_chrdev(major_num, DEVICE_NAME);
+    vfree(ring_mem);
+    kvfree(fifo_buf);
+    pchar_shards_free();
+    kfree(sojourn);
     printk(KERN_INFO "pchar: Unregistered the device\n");
 }
 
 // Open the device
 static int pchar_open(struct inode *inode, struct file *file)
 {
-    printk(KERN_INFO "pchar: Device opened\n");
+    struct pchar_file *pf;
+
+    pf = kzalloc(sizeof(*pf), GFP_KERNEL);
+    if (!pf)
+        return -ENOMEM;
+    file->private_data = pf;
+    // read_iter/write_iter honour IOCB_NOWAIT, so io_uring may issue inline
+    file->f_mode |= FMODE_NOWAIT;
+    atomic_inc(&open_count);
+
+    pr_debug("pchar: Device opened\n");
     return 0;
 }
 
 // Release the device
 static int pchar_release(struct inode *inode, struct file *file)
 {
-    printk(KERN_INFO "pchar: Device closed\n");
+    // Drop this file from the SIGIO notification list
+    pchar_fasync(-1, file, 0);
+    kfree(file->private_data);
+    atomic_dec(&open_count);
+    pr_debug("pchar: Device closed\n");
     return 0;
 }
 
-// Read function: Block if the FIFO is empty, wake up when data is written
-static ssize_t pchar_read(struct file *file, char __user *buf, size_t count, loff_t *pos)
+// Stamp a write that moved the my_fifo 'in' index (wr_lock held)
+static void pchar_stamp(void)
 {
-    int ret;
-    size_t bytes_read = 0;
+    struct pchar_sojourn *sj = sojourn;
+    unsigned int head;
 
-    // Wait if the FIFO is empty
-    while (kfifo_is_empty(&my_fifo)) {
-        ret = wait_event_interruptible(rd_wq, !kfifo_is_empty(&my_fifo));
-        if (ret) {
-            printk(KERN_INFO "pchar: Read interrupted\n");
-            return -ERESTARTSYS;  // Return error if the wait is interrupted
+    if (!sj)
+        return;
+
+    head = sj->head;
+    if (head - smp_load_acquire(&sj->tail) == PCHAR_STAMPS) {
+        // Ring full: fold into the newest stamp, keeping its older time
+        WRITE_ONCE(sj->stamps[(head - 1) % PCHAR_STAMPS].end, my_fifo.kfifo.in);
+        return;
+    }
+    sj->stamps[head % PCHAR_STAMPS].ts = ktime_get_ns();
+    sj->stamps[head % PCHAR_STAMPS].end = my_fifo.kfifo.in;
+    smp_store_release(&sj->head, head + 1);
+}
+
+// After a read moved 'out': record the delay of every write now fully consumed
+// and update the target-delay state (rd_lock held)
+static void pchar_sojourn_account(void)
+{
+    struct pchar_sojourn *sj = sojourn;
+    unsigned int out, tail, head;
+    u64 now, delay = 0;
+
+    if (!sj)
+        return;
+
+    now = ktime_get_ns();
+    out = my_fifo.kfifo.out;
+    tail = sj->tail;
+    head = smp_load_acquire(&sj->head);
+    while (tail != head) {
+        struct pchar_stamp *st = &sj->stamps[tail % PCHAR_STAMPS];
+
+        if ((int)(READ_ONCE(st->end) - out) > 0)
+            break;
+        delay = now - st->ts;
+        sj->hist[min_t(unsigned int, ilog2(max_t(u64, delay / NSEC_PER_USEC, 1)),
+                       PCHAR_SOJOURN_BUCKETS - 1)]++;
+        tail++;
+    }
+    smp_store_release(&sj->tail, tail);
+
+    // CoDel-style: only a delay that stays above target for an interval counts
+    if (kfifo_is_empty(&my_fifo) || !sj->target_ns || (delay && delay <= sj->target_ns)) {
+        sj->above_since = 0;
+        WRITE_ONCE(over_target, false);
+    } else if (delay) {
+        if (!sj->above_since)
+            sj->above_since = now;
+        else if (now - sj->above_since >= sj->interval_ns)
+            WRITE_ONCE(over_target, true);
+    }
+}
+
+// Whether writes should fail with -ENOBUFS (wr_lock held)
+static bool pchar_reject_write(void)
+{
+    return sojourn && sojourn->reject && READ_ONCE(over_target);
+}
+
+// Enable, reconfigure or disable queueing delay tracking
+static int pchar_sojourn_set(struct pchar_sojourn_cfg *cfg)
+{
+    struct pchar_sojourn *sj = NULL, *old;
+
+    // Stamps follow my_fifo's single 'in' index, which the shards do not have
+    if (sharded)
+        return -EINVAL;
+
+    if (cfg->enable) {
+        sj = kzalloc(sizeof(*sj), GFP_KERNEL);
+        if (!sj)
+            return -ENOMEM;
+        sj->target_ns = (u64)cfg->target_us * NSEC_PER_USEC;
+        sj->interval_ns = (u64)cfg->interval_us * NSEC_PER_USEC;
+        sj->reject = cfg->reject;
+    }
+
+    if (mutex_lock_interruptible(&rd_lock)) {
+        kfree(sj);
+        return -ERESTARTSYS;
+    }
+    mutex_lock(&wr_lock);
+    if (sj && sojourn) {
+        // Keep the histogram and pending stamps, only take the new settings
+        sojourn->target_ns = sj->target_ns;
+        sojourn->interval_ns = sj->interval_ns;
+        sojourn->reject = sj->reject;
+        old = sj;
+    } else {
+        // Bytes already queued when tracking starts are not stamped
+        old = sojourn;
+        sojourn = sj;
+        over_target = false;
+    }
+    mutex_unlock(&wr_lock);
+    mutex_unlock(&rd_lock);
+
+    kfree(old);
+    wake_up_interruptible(&wr_wq);
+    return 0;
+}
+
+// Poll function: Readable while data is queued, writable while space is left,
+// EPOLLPRI while the queueing delay is above its target
+static __poll_t pchar_poll(struct file *file, poll_table *wait)
+{
+    struct pchar_file *pf = file->private_data;
+    __poll_t mask = 0;
+    u32 head, tail;
+
+    if (pf->ring_mapped) {
+        poll_wait(file, &ring_wq, wait);
+
+        // Ask the other side to kick us, then look at the indices
+        WRITE_ONCE(ring_ctrl->rd_waiting, 1);
+        WRITE_ONCE(ring_ctrl->wr_waiting, 1);
+        smp_mb();
+        head = READ_ONCE(ring_ctrl->head);
+        tail = READ_ONCE(ring_ctrl->tail);
+
+        if (head != tail)
+            mask |= EPOLLIN | EPOLLRDNORM;
+        if (head - tail < ring_size)
+            mask |= EPOLLOUT | EPOLLWRNORM;
+        return mask;
+    }
+
+    poll_wait(file, &rd_wq, wait);
+    poll_wait(file, &wr_wq, wait);
+
+    if (!pchar_is_empty())
+        mask |= EPOLLIN | EPOLLRDNORM;
+    if (pchar_has_space())
+        mask |= EPOLLOUT | EPOLLWRNORM;
+    if (READ_ONCE(over_target))
+        mask |= EPOLLPRI;
+
+    return mask;
+}
+
+// Fasync function: Add or remove the file from the SIGIO list
+static int pchar_fasync(int fd, struct file *file, int on)
+{
+    return fasync_helper(fd, file, on, &async_queue);
+}
+
+// Check whether the ring has data (rd) or space (!rd)
+static bool pchar_ring_ready(bool rd)
+{
+    u32 head = READ_ONCE(ring_ctrl->head);
+    u32 tail = READ_ONCE(ring_ctrl->tail);
+
+    return rd ? head != tail : head - tail < ring_size;
+}
+
+// Sleep until the ring has data (or space), asking user space to kick us
+static int pchar_ring_wait(bool rd)
+{
+    __u32 *flag = rd ? &ring_ctrl->rd_waiting : &ring_ctrl->wr_waiting;
+    DEFINE_WAIT(wait);
+    int ret = 0;
+
+    for (;;) {
+        prepare_to_wait(&ring_wq, &wait, TASK_INTERRUPTIBLE);
+        // Re-arm on every pass, an earlier kick may have cleared the flag
+        WRITE_ONCE(*flag, 1);
+        smp_mb();  // flag store before index loads, pairs with the user-side fence
+        if (pchar_ring_ready(rd))
+            break;
+        if (signal_pending(current)) {
+            ret = -ERESTARTSYS;
+            break;
         }
+        schedule();
     }
+    finish_wait(&ring_wq, &wait);
+
+    return ret;
+}
+
+// Batch ioctls: move up to batch.count messages in one call. Only the first
+// message may block; the batch stops early once the FIFO is full or empty.
+static long pchar_msg_batch(struct file *file, unsigned int cmd, unsigned long arg)
+{
+    struct pchar_msg_batch __user *ubatch = (void __user *)arg;
+    struct pchar_msg_batch batch;
+    struct iovec __user *uiov;
+    struct iovec iov;
+    struct iov_iter iter;
+    struct kiocb kiocb;
+    ssize_t ret = 0;
+    u32 i;
+
+    if (copy_from_user(&batch, ubatch, sizeof(batch)))
+        return -EFAULT;
+    uiov = u64_to_user_ptr(batch.iov);
+    init_sync_kiocb(&kiocb, file);
+
+    for (i = 0; i < batch.count; i++) {
+        if (copy_from_user(&iov, &uiov[i], sizeof(iov))) {
+            ret = -EFAULT;
+            break;
+        }
 
-    // Read from the FIFO
-    while (bytes_read < count && !kfifo_is_empty(&my_fifo)) {
-        ret = kfifo_out(&my_fifo, &buf[bytes_read], 1);
-        if (ret > 0) {
-            bytes_read++;
+        if (cmd == PCHAR_ENQ_BATCH) {
+            ret = import_single_range(WRITE, iov.iov_base, iov.iov_len, &iov, &iter);
+            if (!ret)
+                ret = pchar_write_iter(&kiocb, &iter);
         } else {
-            break;  // Stop if no more data is available
+            ret = import_single_range(READ, iov.iov_base, iov.iov_len, &iov, &iter);
+            if (!ret)
+                ret = pchar_read_iter(&kiocb, &iter);
+            if (ret >= 0 && put_user(ret, &uiov[i].iov_len))
+                ret = -EFAULT;
         }
+        if (ret < 0)
+            break;
+
+        kiocb.ki_flags |= IOCB_NOWAIT;
     }
 
-    printk(KERN_INFO "pchar: Read %zu bytes\n", bytes_read);
-    return bytes_read;
+    if (!i && batch.count)
+        return ret;
+    if (put_user(i, &ubatch->done))
+        return -EFAULT;
+    return i;
 }
 
-// Write function: Write to the FIFO and wake up the reader if it's blocked
-static ssize_t pchar_write(struct file *file, const char __user *buf, size_t count, loff_t *pos)
+// IOCTL function: Sleep/wake helpers for the shared ring, message mode
+static long pchar_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
-    int i;
+    long ret = 0;
+
+    switch (cmd) {
+        case PCHAR_RING_WAIT_DATA:
+            return pchar_ring_wait(true);
+
+        case PCHAR_RING_WAIT_SPACE:
+            return pchar_ring_wait(false);
+
+        case PCHAR_RING_KICK:
+            WRITE_ONCE(ring_ctrl->rd_waiting, 0);
+            WRITE_ONCE(ring_ctrl->wr_waiting, 0);
+            wake_up_interruptible(&ring_wq);
+            return 0;
+
+        case PCHAR_SET_MSG_MODE:
+            // Only switch framing while nobody else uses the device and nothing is queued
+            if (mutex_lock_interruptible(&rd_lock))
+                return -ERESTARTSYS;
+            mutex_lock(&wr_lock);
+            if (sharded)
+                ret = -EINVAL;
+            else if (atomic_read(&open_count) > 1 || !kfifo_is_empty(&my_fifo))
+                ret = -EBUSY;
+            else
+                msg_mode = !!arg;
+            mutex_unlock(&wr_lock);
+            mutex_unlock(&rd_lock);
+            return ret;
+
+        case PCHAR_ENQ_BATCH:
+        case PCHAR_DEQ_BATCH:
+            return pchar_msg_batch(file, cmd, arg);
+
+        case PCHAR_SET_SOJOURN: {
+            struct pchar_sojourn_cfg cfg;
+
+            if (copy_from_user(&cfg, (void __user *)arg, sizeof(cfg)))
+                return -EFAULT;
+            return pchar_sojourn_set(&cfg);
+        }
+
+        default:
+            return -ENOTTY;
+    }
+}
+
+// Mmap function: Map the control page and ring data into user space
+static int pchar_mmap(struct file *file, struct vm_area_struct *vma)
+{
+    struct pchar_file *pf = file->private_data;
     int ret;
 
-    // Write data to the FIFO
-    for (i = 0; i < count; i++) {
-        ret = kfifo_in(&my_fifo, &buf[i], 1);
-        if (ret != 1) {
-            printk(KERN_ALERT "pchar: Failed to write to FIFO\n");
-            return -ENOMEM;
+    ret = remap_vmalloc_range(vma, ring_mem, vma->vm_pgoff);
+    if (ret)
+        return ret;
+
+    pf->ring_mapped = true;
+    return 0;
+}
+
+// Copy 'len' bytes starting at index 'idx' of a power-of-two ring into 'to',
+// one copy per segment
+static size_t pchar_ring_copy_to_iter(char *buf, unsigned int size, unsigned int idx,
+                                      struct iov_iter *to, size_t len)
+{
+    unsigned int off = idx & (size - 1);
+    size_t l = min_t(size_t, len, size - off);
+    size_t copied;
+
+    copied = copy_to_iter(buf + off, l, to);
+    if (copied == l && len > l)
+        copied += copy_to_iter(buf, len - l, to);
+    return copied;
+}
+
+// Copy 'len' bytes from 'from' to index 'idx' of a power-of-two ring
+static size_t pchar_ring_copy_from_iter(char *buf, unsigned int size, unsigned int idx,
+                                        struct iov_iter *from, size_t len)
+{
+    unsigned int off = idx & (size - 1);
+    size_t l = min_t(size_t, len, size - off);
+    size_t copied;
+
+    copied = copy_from_iter(buf + off, l, from);
+    if (copied == l && len > l)
+        copied += copy_from_iter(buf, len - l, from);
+    return copied;
+}
+
+// Copy 'len' bytes starting at FIFO index 'idx' into 'to'
+static size_t pchar_fifo_copy_to_iter(unsigned int idx, struct iov_iter *to, size_t len)
+{
+    return pchar_ring_copy_to_iter(fifo_buf, fifo_size, idx, to, len);
+}
+
+// Copy 'len' bytes from 'from' to FIFO index 'idx'
+static size_t pchar_fifo_copy_from_iter(unsigned int idx, struct iov_iter *from, size_t len)
+{
+    return pchar_ring_copy_from_iter(fifo_buf, fifo_size, idx, from, len);
+}
+
+// Copy up to 'len' queued bytes into 'to'
+static size_t pchar_fifo_to_iter(struct iov_iter *to, size_t len)
+{
+    size_t copied;
+
+    len = min_t(size_t, len, kfifo_len(&my_fifo));
+    copied = pchar_fifo_copy_to_iter(my_fifo.kfifo.out, to, len);
+
+    // Finish reading the data before handing the space back, as kfifo_out does
+    smp_wmb();
+    my_fifo.kfifo.out += copied;
+    return copied;
+}
+
+// Copy up to 'len' bytes from 'from' into free FIFO space
+static size_t pchar_fifo_from_iter(struct iov_iter *from, size_t len)
+{
+    size_t copied;
+
+    len = min_t(size_t, len, kfifo_avail(&my_fifo));
+    copied = pchar_fifo_copy_from_iter(my_fifo.kfifo.in, from, len);
+
+    // Publish the data before the new index, as kfifo_in does
+    smp_wmb();
+    my_fifo.kfifo.in += copied;
+    return copied;
+}
+
+// Queue 'len' bytes from 'from' as one record; the caller checked that it fits.
+// Header and payload are published together, so readers never see half a record.
+static int pchar_rec_from_iter(struct iov_iter *from, size_t len)
+{
+    unsigned int in = my_fifo.kfifo.in;
+
+    if (pchar_fifo_copy_from_iter(in + PCHAR_REC_HDR, from, len) != len)
+        return -EFAULT;
+    fifo_buf[in & (fifo_size - 1)] = len & 0xff;
+    fifo_buf[(in + 1) & (fifo_size - 1)] = len >> 8;
+
+    smp_wmb();
+    my_fifo.kfifo.in = in + len + PCHAR_REC_HDR;
+    return 0;
+}
+
+// Dequeue the next record into 'to', truncated to 'len' bytes like kfifo_rec_out.
+// A fault leaves the record queued.
+static ssize_t pchar_rec_to_iter(struct iov_iter *to, size_t len)
+{
+    unsigned int out = my_fifo.kfifo.out;
+    unsigned int n = (unsigned char)fifo_buf[out & (fifo_size - 1)] |
+                     (unsigned char)fifo_buf[(out + 1) & (fifo_size - 1)] << 8;
+
+    len = min_t(size_t, len, n);
+    if (pchar_fifo_copy_to_iter(out + PCHAR_REC_HDR, to, len) != len)
+        return -EFAULT;
+
+    smp_wmb();
+    my_fifo.kfifo.out = out + n + PCHAR_REC_HDR;
+    return len;
+}
+
+static unsigned int pchar_shard_len(struct pchar_shard *sh)
+{
+    return READ_ONCE(sh->head) - READ_ONCE(sh->tail);
+}
+
+// Copy up to 'len' bytes from 'from' into the shard (sh->lock held)
+static size_t pchar_shard_from_iter(struct pchar_shard *sh, struct iov_iter *from, size_t len)
+{
+    size_t copied;
+
+    len = min_t(size_t, len, shard_size - pchar_shard_len(sh));
+    copied = pchar_ring_copy_from_iter(sh->buf, shard_size, sh->head, from, len);
+    smp_store_release(&sh->head, sh->head + copied);
+    return copied;
+}
+
+// Copy up to 'len' queued bytes of the shard into 'to' (rd_lock held)
+static size_t pchar_shard_to_iter(struct pchar_shard *sh, struct iov_iter *to, size_t len)
+{
+    size_t copied;
+
+    len = min_t(size_t, len, smp_load_acquire(&sh->head) - sh->tail);
+    copied = pchar_ring_copy_to_iter(sh->buf, shard_size, sh->tail, to, len);
+    smp_store_release(&sh->tail, sh->tail + copied);
+    return copied;
+}
+
+// Drain the shards round-robin into 'to', starting after the shard the last
+// read ended in, until 'to' is full or every shard is empty (rd_lock held)
+static size_t pchar_shards_to_iter(struct iov_iter *to, size_t len)
+{
+    struct pchar_shard *sh;
+    size_t copied = 0, n, want;
+    int cpu;
+
+    for_each_cpu_wrap(cpu, cpu_possible_mask, shard_next) {
+        sh = per_cpu_ptr(&pchar_shards, cpu);
+        want = min_t(size_t, len - copied, pchar_shard_len(sh));
+        if (!want)
+            continue;
+        n = pchar_shard_to_iter(sh, to, want);
+        copied += n;
+        shard_next = (cpu + 1) % nr_cpu_ids;
+        if (n < want || copied == len)
+            break;
+    }
+    return copied;
+}
+
+// Whether nothing is queued, in my_fifo or in any shard
+static bool pchar_is_empty(void)
+{
+    int cpu;
+
+    if (!sharded)
+        return kfifo_is_empty(&my_fifo);
+    for_each_possible_cpu(cpu)
+        if (pchar_shard_len(per_cpu_ptr(&pchar_shards, cpu)))
+            return false;
+    return true;
+}
+
+// Bytes queued, for tracing
+static unsigned int pchar_queued(void)
+{
+    unsigned int queued = 0;
+    int cpu;
+
+    if (!sharded)
+        return kfifo_len(&my_fifo);
+    for_each_possible_cpu(cpu)
+        queued += pchar_shard_len(per_cpu_ptr(&pchar_shards, cpu));
+    return queued;
+}
+
+// Whether a write from here would find space: in this CPU's shard if sharded
+static bool pchar_has_space(void)
+{
+    if (!sharded)
+        return !kfifo_is_full(&my_fifo) && !READ_ONCE(wr_head);
+    return pchar_shard_len(raw_cpu_ptr(&pchar_shards)) < shard_size;
+}
+
+// Take rd_lock or wr_lock; an IOCB_NOWAIT caller (io_uring) must not sleep
+// on the lock either and gets -EAGAIN instead
+static int pchar_lock(struct mutex *lock, struct kiocb *iocb)
+{
+    if (iocb->ki_flags & IOCB_NOWAIT)
+        return mutex_trylock(lock) ? 0 : -EAGAIN;
+    return mutex_lock_interruptible(lock) ? -ERESTARTSYS : 0;
+}
+
+// Read from the FIFO, blocking while it is empty
+static ssize_t pchar_do_read(struct kiocb *iocb, struct iov_iter *to)
+{
+    struct file *file = iocb->ki_filp;
+    bool nonblock = (file->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT);
+    size_t count = iov_iter_count(to);
+    ssize_t copied;
+    unsigned int queued;
+    int ret;
+
+    // A zero-length read still consumes one (possibly empty) message
+    if (!count && !msg_mode)
+        return 0;
+
+    // Wait if the FIFO is empty. Sleep without rd_lock, so the ioctls and
+    // debugfs files that take it are not held up by an idle reader.
+    for (;;) {
+        ret = pchar_lock(&rd_lock, iocb);
+        if (ret)
+            return ret;
+        if (!pchar_is_empty())
+            break;
+
+        mutex_unlock(&rd_lock);
+        if (nonblock)
+            return -EAGAIN;
+        this_cpu_inc(pchar_stats.waits);
+        trace_pchar_wait(false);
+        if (wait_event_interruptible(rd_wq, !pchar_is_empty()))
+            return -ERESTARTSYS;  // Return error if the wait is interrupted
+        trace_pchar_wake(false);
+    }
+
+    if (msg_mode) {
+        copied = pchar_rec_to_iter(to, count);
+    } else {
+        // A fault part way through still consumed 'copied' bytes, so report them
+        if (sharded)
+            copied = pchar_shards_to_iter(to, count);
+        else
+            copied = pchar_fifo_to_iter(to, count);
+        if (!copied)
+            copied = -EFAULT;
+    }
+    if (copied >= 0)
+        pchar_sojourn_account();
+    queued = pchar_queued();
+    mutex_unlock(&rd_lock);
+
+    if (copied < 0)
+        return copied;
+    trace_pchar_dequeue(copied, queued);
+
+    // Space was freed, let writers and SIGIO listeners know
+    wake_up_interruptible(&wr_wq);
+    kill_fasync(&async_queue, SIGIO, POLL_OUT);
+    return copied;
+}
+
+// Message mode write: queue the whole buffer as one record or nothing
+static ssize_t pchar_write_msg(struct kiocb *iocb, bool nonblock, struct iov_iter *from,
+                               size_t count)
+{
+    size_t need = count + PCHAR_REC_HDR;
+    unsigned int queued;
+    int ret;
+
+    if (count > PCHAR_REC_MAX)
+        return -EMSGSIZE;
+
+    for (;;) {
+        ret = pchar_lock(&wr_lock, iocb);
+        if (ret)
+            return ret;
+        if (pchar_reject_write()) {
+            mutex_unlock(&wr_lock);
+            return -ENOBUFS;
         }
+        if (kfifo_avail(&my_fifo) >= need)
+            break;
+
+        mutex_unlock(&wr_lock);
+        if (nonblock)
+            return -EAGAIN;
+        this_cpu_inc(pchar_stats.waits);
+        trace_pchar_wait(true);
+        if (wait_event_interruptible(wr_wq, kfifo_avail(&my_fifo) >= need))
+            return -ERESTARTSYS;
+        trace_pchar_wake(true);
     }
 
-    // Wake up the reader if it's waiting
-    wake_up_interruptible(&rd_wq);
+    ret = pchar_rec_from_iter(from, count);
+    if (!ret)
+        pchar_stamp();
+    queued = kfifo_len(&my_fifo);
+    mutex_unlock(&wr_lock);
+    if (ret)
+        return ret;
+    trace_pchar_enqueue(count, queued);
 
-    printk(KERN_INFO "pchar: Written %zu bytes\n", count);
+    wake_up_interruptible(&rd_wq);
+    kill_fasync(&async_queue, SIGIO, POLL_IN);
     return count;
 }
 
+// Multi-producer write: copy into the shard of the CPU the write started on,
+// blocking while it is full. Writers on other CPUs are never waited for.
+static ssize_t pchar_write_sharded(struct kiocb *iocb, bool nonblock, struct iov_iter *from,
+                                   size_t count)
+{
+    size_t need = count <= shard_size ? count : 1;
+    size_t written = 0;
+    size_t copied;
+    // Keep one shard for the whole call so its bytes stay in order
+    struct pchar_shard *sh = per_cpu_ptr(&pchar_shards, raw_smp_processor_id());
+    unsigned int queued;
+    int ret = 0;
+
+    while (written < count) {
+        ret = pchar_lock(&sh->lock, iocb);
+        if (ret)
+            break;
+
+        if (shard_size - pchar_shard_len(sh) < need) {
+            mutex_unlock(&sh->lock);
+            if (nonblock) {
+                ret = -EAGAIN;
+                break;
+            }
+            this_cpu_inc(pchar_stats.waits);
+            trace_pchar_wait(true);
+            if (wait_event_interruptible(wr_wq, shard_size - pchar_shard_len(sh) >= need)) {
+                ret = -ERESTARTSYS;
+                break;
+            }
+            trace_pchar_wake(true);
+            continue;
+        }
+
+        copied = pchar_shard_from_iter(sh, from, count - written);
+        queued = pchar_shard_len(sh);
+        mutex_unlock(&sh->lock);
+        if (!copied) {
+            ret = -EFAULT;
+            break;
+        }
+        written += copied;
+        trace_pchar_enqueue(copied, queued);
+
+        // Only touch the shared wait queue lock when the reader sleeps on it
+        if (wq_has_sleeper(&rd_wq))
+            wake_up_interruptible(&rd_wq);
+        kill_fasync(&async_queue, SIGIO, POLL_IN);
+    }
+
+    return written ? written : ret;
+}
+
+// Leave the writer queue and let the next waiter check for space (wr_lock held)
+static void pchar_writer_dequeue(struct pchar_writer *w)
+{
+    list_del(&w->node);
+    WRITE_ONCE(wr_head, list_first_entry_or_null(&wr_queue, struct pchar_writer, node));
+    wake_up_interruptible(&wr_wq);
+}
+
+// Write to the FIFO, blocking while it is full
+static ssize_t pchar_do_write(struct kiocb *iocb, struct iov_iter *from)
+{
+    struct file *file = iocb->ki_filp;
+    bool nonblock = (file->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT);
+    size_t count = iov_iter_count(from);
+    int ret = 0;
+    size_t copied;
+    size_t written = 0;
+    unsigned int queued;
+    // Like pipe writes up to PIPE_BUF, a write that fits the FIFO goes in whole
+    size_t need = count <= fifo_size ? count : 1;
+    struct pchar_writer me;
+    bool waiting = false;
+
+    if (msg_mode)
+        return pchar_write_msg(iocb, nonblock, from, count);
+    if (sharded)
+        return pchar_write_sharded(iocb, nonblock, from, count);
+
+    while (written < count) {
+        ret = pchar_lock(&wr_lock, iocb);
+        if (ret)
+            break;
+
+        // Target delay exceeded: tell the producer to back off
+        if (pchar_reject_write()) {
+            mutex_unlock(&wr_lock);
+            ret = -ENOBUFS;
+            break;
+        }
+
+        // Wait for space, and behind every writer that was waiting before us
+        if ((waiting ? wr_head != &me : !list_empty(&wr_queue)) ||
+            kfifo_avail(&my_fifo) < need) {
+            if (nonblock) {
+                mutex_unlock(&wr_lock);
+                ret = -EAGAIN;
+                break;
+            }
+            if (!waiting) {
+                list_add_tail(&me.node, &wr_queue);
+                if (!wr_head)
+                    WRITE_ONCE(wr_head, &me);
+                waiting = true;
+            }
+            // Sleep without the lock, so the head of the queue can take it
+            mutex_unlock(&wr_lock);
+            this_cpu_inc(pchar_stats.waits);
+            trace_pchar_wait(true);
+            if (wait_event_interruptible(wr_wq, READ_ONCE(wr_head) == &me &&
+                                                kfifo_avail(&my_fifo) >= need)) {
+                ret = -ERESTARTSYS;
+                break;
+            }
+            trace_pchar_wake(true);
+            continue;
+        }
+
+        // Copy as much as fits straight from the source buffer
+        copied = pchar_fifo_from_iter(from, count - written);
+        if (copied)
+            pchar_stamp();
+        queued = kfifo_len(&my_fifo);
+        mutex_unlock(&wr_lock);
+        if (!copied) {
+            ret = -EFAULT;
+            break;
+        }
+        written += copied;
+        trace_pchar_enqueue(copied, queued);
+
+        // Wake up the reader if it's waiting
+        wake_up_interruptible(&rd_wq);
+        kill_fasync(&async_queue, SIGIO, POLL_IN);
+    }
+
+    if (waiting) {
+        mutex_lock(&wr_lock);
+        pchar_writer_dequeue(&me);
+        mutex_unlock(&wr_lock);
+    }
+
+    // Bytes already queued are reported even if a signal or fault cut us short
+    return written ? written : ret;
+}
+
+// Count a finished read or write in this CPU's counters
+static void pchar_account(bool writer, ssize_t ret)
+{
+    struct pchar_stats *st = get_cpu_ptr(&pchar_stats);
+
+    if (ret < 0) {
+        if (ret != -EAGAIN)
+            st->fails++;
+    } else if (writer) {
+        st->wr_bytes += ret;
+        st->wr_ops++;
+    } else {
+        st->rd_bytes += ret;
+        st->rd_ops++;
+    }
+    put_cpu_ptr(&pchar_stats);
+}
+
+// Read function: Block if the FIFO is empty, wake up when data is written.
+// Also backs splice_read, where 'to' points at pipe pages instead of user memory.
+static ssize_t pchar_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+    ssize_t ret = pchar_do_read(iocb, to);
+
+    pchar_account(false, ret);
+    return ret;
+}
+
+// Write function: Block while the FIFO is full, wake up the reader as data lands.
+// Also backs splice_write, where 'from' points at pipe pages.
+static ssize_t pchar_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+    ssize_t ret = pchar_do_write(iocb, from);
+
+    pchar_account(true, ret);
+    return ret;
+}
+
 module_init(pchar_init);
 module_exit(pchar_exit);
 
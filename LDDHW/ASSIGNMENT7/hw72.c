@@ -4,15 +4,48 @@
 #include <linux/fs.h>
 #include <linux/uaccess.h>
 #include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/sched.h>
+#include <linux/interval_tree.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/uio.h>
 
 #define DEVICE_NAME "pchar"  // Device name
-#define BUF_SIZE 1024       // Buffer size
+#define BUF_SIZE 1024       // Default buffer size
 
-// Mutex for device access control
+// Size of device_buffer in bytes; large values need a 64-bit vmalloc area
+static unsigned long buf_size = BUF_SIZE;
+module_param(buf_size, ulong, 0444);
+MODULE_PARM_DESC(buf_size, "Bytes in the device buffer (default 1024)");
+
+// Shared mode: any number of openers, serialized only per buffer range
+static bool shared;
+module_param(shared, bool, 0444);
+MODULE_PARM_DESC(shared, "Allow concurrent openers instead of exclusive open");
+
+// Mutex for device access control (exclusive mode only)
 static DEFINE_MUTEX(dev_mutex);
 
-// Device buffer
-static char device_buffer[BUF_SIZE];
+// Byte range lock: every reader and writer inserts its range into range_tree
+// and waits only for earlier overlapping ranges that conflict with it (any
+// overlap involving a writer). Waiters are served in arrival order, so a
+// stream of readers cannot starve a writer. One lock per I/O, whatever its
+// length, so lockdep sees a single spinlock instead of nested rwsems.
+struct range_lock {
+    struct interval_tree_node node;  // [start, last] bytes of device_buffer
+    struct task_struct *task;
+    u64 seq;                         // arrival order
+    unsigned int blocking;           // earlier conflicting ranges still in the tree
+    bool write;
+};
+
+static DEFINE_SPINLOCK(range_tree_lock);
+static struct rb_root_cached range_tree = RB_ROOT_CACHED;
+static u64 range_seq;
+
+// Device buffer: zeroed vmalloc_user pages, so the whole of it can be mmap'ed
+static char *device_buffer;
 
 // Major number for the device
 static int major_num;
@@ -20,28 +53,44 @@ static int major_num;
 // File operations
 static int pchar_open(struct inode *inode, struct file *file);
 static int pchar_release(struct inode *inode, struct file *file);
-static ssize_t pchar_read(struct file *file, char __user *buf, size_t count, loff_t *pos);
-static ssize_t pchar_write(struct file *file, const char __user *buf, size_t count, loff_t *pos);
+static ssize_t pchar_read_iter(struct kiocb *iocb, struct iov_iter *to);
+static ssize_t pchar_write_iter(struct kiocb *iocb, struct iov_iter *from);
+static loff_t pchar_llseek(struct file *file, loff_t offset, int whence);
+static int pchar_mmap(struct file *file, struct vm_area_struct *vma);
 
 static const struct file_operations fops = {
     .owner = THIS_MODULE,
+    .llseek = pchar_llseek,
+    .mmap = pchar_mmap,
     .open = pchar_open,
     .release = pchar_release,
-    .read = pchar_read,
-    .write = pchar_write,
+    .read_iter = pchar_read_iter,
+    .write_iter = pchar_write_iter,
 };
 
 // Module initialization function
 static int __init pchar_init(void)
 {
+    if (!buf_size) {
+        printk(KERN_ALERT "pchar: buf_size must not be 0\n");
+        return -EINVAL;
+    }
+    device_buffer = vmalloc_user(PAGE_ALIGN(buf_size));
+    if (!device_buffer) {
+        printk(KERN_ALERT "pchar: Failed to allocate %lu buffer bytes\n", buf_size);
+        return -ENOMEM;
+    }
+
     // Register the character device
     major_num = register_chrdev(0, DEVICE_NAME, &fops);
     if (major_num < 0) {
         printk(KERN_ALERT "pchar: Failed to register a major number\n");
+        vfree(device_buffer);
         return major_num;
     }
 
-    printk(KERN_INFO "pchar: Registered with major number %d\n", major_num);
+    printk(KERN_INFO "pchar: Registered with major number %d, %lu buffer bytes\n",
+           major_num, buf_size);
     return 0;
 }
 
@@ -50,70 +99,184 @@ static void __exit pchar_exit(void)
 {
     // Unregister the character device
     unregister_chrdev(major_num, DEVICE_NAME);
+    vfree(device_buffer);
     printk(KERN_INFO "pchar: Unregistered the device\n");
 }
 
-// Open the device: Ensure only one process can open it at a time
+#define range_for_each(n, rl) \
+    for (n = interval_tree_iter_first(&range_tree, (rl)->node.start, (rl)->node.last); n; \
+         n = interval_tree_iter_next(n, (rl)->node.start, (rl)->node.last))
+
+// Take 'rl' out of the tree and wake the later ranges it was holding up.
+// Called with range_tree_lock held.
+static void range_remove(struct range_lock *rl)
+{
+    struct interval_tree_node *n;
+    struct range_lock *other;
+
+    interval_tree_remove(&rl->node, &range_tree);
+    range_for_each(n, rl) {
+        other = container_of(n, struct range_lock, node);
+        if (other->seq > rl->seq && (rl->write || other->write) && !--other->blocking)
+            wake_up_process(other->task);
+    }
+}
+
+// Lock the bytes [pos, pos + len). With nowait (IOCB_NOWAIT from io_uring)
+// a busy range backs out with -EAGAIN instead of sleeping.
+static int range_lock(struct range_lock *rl, loff_t pos, size_t len, bool write, bool nowait)
+{
+    struct interval_tree_node *n;
+    struct range_lock *other;
+
+    rl->node.start = pos;
+    rl->node.last = pos + len - 1;
+    rl->task = current;
+    rl->blocking = 0;
+    rl->write = write;
+
+    spin_lock(&range_tree_lock);
+    range_for_each(n, rl) {
+        other = container_of(n, struct range_lock, node);
+        if (write || other->write)
+            rl->blocking++;
+    }
+    rl->seq = ++range_seq;
+    interval_tree_insert(&rl->node, &range_tree);
+
+    if (rl->blocking && nowait) {
+        range_remove(rl);
+        spin_unlock(&range_tree_lock);
+        return -EAGAIN;
+    }
+    // range_remove() of the last range ahead of us wakes us up
+    while (rl->blocking) {
+        set_current_state(TASK_UNINTERRUPTIBLE);
+        spin_unlock(&range_tree_lock);
+        schedule();
+        spin_lock(&range_tree_lock);
+    }
+    spin_unlock(&range_tree_lock);
+    return 0;
+}
+
+static void range_unlock(struct range_lock *rl)
+{
+    spin_lock(&range_tree_lock);
+    range_remove(rl);
+    spin_unlock(&range_tree_lock);
+}
+
+// Open the device: Ensure only one process can open it at a time, unless shared
 static int pchar_open(struct inode *inode, struct file *file)
 {
+    // Only range locks are taken and they honour IOCB_NOWAIT, so io_uring
+    // may issue reads and writes inline
+    file->f_mode |= FMODE_NOWAIT;
+
+    if (shared) {
+        pr_debug("pchar: Device opened (shared)\n");
+        return 0;
+    }
+
     if (!mutex_trylock(&dev_mutex)) {
         // If mutex is already locked (device is open), block the process
-        printk(KERN_INFO "pchar: Device is already open by another process. Blocking.\n");
+        pr_debug("pchar: Device is already open by another process. Blocking.\n");
         return -EBUSY;  // Device is busy, block this process
     }
 
-    printk(KERN_INFO "pchar: Device opened\n");
+    pr_debug("pchar: Device opened\n");
     return 0;  // Device successfully opened
 }
 
 // Release the device: Unlock the mutex when the device is closed
 static int pchar_release(struct inode *inode, struct file *file)
 {
-    mutex_unlock(&dev_mutex);  // Release the mutex when the device is closed
-    printk(KERN_INFO "pchar: Device closed\n");
+    if (!shared)
+        mutex_unlock(&dev_mutex);  // Release the mutex when the device is closed
+    pr_debug("pchar: Device closed\n");
     return 0;
 }
 
-// Read from the device: Simple echo functionality (example)
-static ssize_t pchar_read(struct file *file, char __user *buf, size_t count, loff_t *pos)
+// Read from the device: Copy out of the buffer in one pass over all of the
+// caller's segments (read, readv, preadv2, io_uring and AIO all land here)
+static ssize_t pchar_read_iter(struct kiocb *iocb, struct iov_iter *to)
 {
-    size_t bytes_read = count;
+    loff_t pos = iocb->ki_pos;
+    size_t bytes_read = iov_iter_count(to);
+    struct range_lock rl;
+    size_t copied;
+    int ret;
 
-    if (*pos >= BUF_SIZE) {
+    if (pos >= buf_size) {
         return 0;  // No more data to read
     }
 
-    if (*pos + count > BUF_SIZE) {
-        bytes_read = BUF_SIZE - *pos;  // Limit read size to available data
+    if (pos + bytes_read > buf_size) {
+        bytes_read = buf_size - pos;  // Limit read size to available data
     }
 
-    if (copy_to_user(buf, device_buffer + *pos, bytes_read)) {
+    if (!bytes_read)
+        return 0;
+
+    // Readers share byte ranges, so only a writer to overlapping bytes waits
+    ret = range_lock(&rl, pos, bytes_read, false, iocb->ki_flags & IOCB_NOWAIT);
+    if (ret)
+        return ret;
+    copied = copy_to_iter(device_buffer + pos, bytes_read, to);
+    range_unlock(&rl);
+    if (!copied) {
         return -EFAULT;  // Error in copying data to user space
     }
 
-    *pos += bytes_read;  // Update file position
-    return bytes_read;
+    iocb->ki_pos = pos + copied;  // Update file position
+    return copied;
 }
 
-// Write to the device: Simple write functionality (example)
-static ssize_t pchar_write(struct file *file, const char __user *buf, size_t count, loff_t *pos)
+// Write to the device: Copy into the buffer from all of the caller's segments
+static ssize_t pchar_write_iter(struct kiocb *iocb, struct iov_iter *from)
 {
-    size_t bytes_written = count;
+    loff_t pos = iocb->ki_pos;
+    size_t bytes_written = iov_iter_count(from);
+    struct range_lock rl;
+    size_t copied;
+    int ret;
 
-    if (*pos >= BUF_SIZE) {
+    if (pos >= buf_size) {
         return -ENOSPC;  // No space left on device
     }
 
-    if (*pos + count > BUF_SIZE) {
-        bytes_written = BUF_SIZE - *pos;  // Limit write size to available space
+    if (pos + bytes_written > buf_size) {
+        bytes_written = buf_size - pos;  // Limit write size to available space
     }
 
-    if (copy_from_user(device_buffer + *pos, buf, bytes_written)) {
+    if (!bytes_written)
+        return 0;
+
+    ret = range_lock(&rl, pos, bytes_written, true, iocb->ki_flags & IOCB_NOWAIT);
+    if (ret)
+        return ret;
+    copied = copy_from_iter(device_buffer + pos, bytes_written, from);
+    range_unlock(&rl);
+    if (!copied) {
         return -EFAULT;  // Error in copying data from user space
     }
 
-    *pos += bytes_written;  // Update file position
-    return bytes_written;
+    iocb->ki_pos = pos + copied;  // Update file position
+    return copied;
+}
+
+// Seek within the buffer; SEEK_END is relative to buf_size
+static loff_t pchar_llseek(struct file *file, loff_t offset, int whence)
+{
+    return fixed_size_llseek(file, offset, whence, buf_size);
+}
+
+// Mmap function: Map the buffer pages so random access needs no syscalls.
+// Stores through the mapping do not take the range locks.
+static int pchar_mmap(struct file *file, struct vm_area_struct *vma)
+{
+    return remap_vmalloc_range(vma, device_buffer, vma->vm_pgoff);
 }
 
 module_init(pchar_init);
@@ -121,5 +284,5 @@ module_exit(pchar_exit);
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("shantanu ghadge <shantanughadge6@gmail.com>");
-MODULE_DESCRIPTION("A simple char driver with exclusive open access.");
+MODULE_DESCRIPTION("A simple char driver with exclusive or shared open access.");
 
@@ -0,0 +1,60 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM pchar
+
+#if !defined(_HW7_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _HW7_TRACE_H
+
+#include <linux/tracepoint.h>
+
+// Data moved into or out of my_fifo; 'queued' is the occupancy afterwards
+DECLARE_EVENT_CLASS(pchar_xfer,
+    TP_PROTO(size_t bytes, unsigned int queued),
+    TP_ARGS(bytes, queued),
+    TP_STRUCT__entry(
+        __field(size_t, bytes)
+        __field(unsigned int, queued)
+    ),
+    TP_fast_assign(
+        __entry->bytes = bytes;
+        __entry->queued = queued;
+    ),
+    TP_printk("bytes=%zu queued=%u", __entry->bytes, __entry->queued)
+);
+
+DEFINE_EVENT(pchar_xfer, pchar_enqueue,
+    TP_PROTO(size_t bytes, unsigned int queued),
+    TP_ARGS(bytes, queued));
+
+DEFINE_EVENT(pchar_xfer, pchar_dequeue,
+    TP_PROTO(size_t bytes, unsigned int queued),
+    TP_ARGS(bytes, queued));
+
+// A reader or writer going to sleep on the FIFO, and resuming
+DECLARE_EVENT_CLASS(pchar_sleep,
+    TP_PROTO(bool writer),
+    TP_ARGS(writer),
+    TP_STRUCT__entry(
+        __field(bool, writer)
+    ),
+    TP_fast_assign(
+        __entry->writer = writer;
+    ),
+    TP_printk("%s", __entry->writer ? "writer" : "reader")
+);
+
+DEFINE_EVENT(pchar_sleep, pchar_wait,
+    TP_PROTO(bool writer),
+    TP_ARGS(writer));
+
+DEFINE_EVENT(pchar_sleep, pchar_wake,
+    TP_PROTO(bool writer),
+    TP_ARGS(writer));
+
+#endif /* _HW7_TRACE_H */
+
+// This part must be outside the header guard
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE hw7_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,228 @@
+// Userspace benchmark: the shared drain scheduler of hw82.c with many devices.
+//
+// Starts the drain timer on -n devices (10000 by default), keeps them fed
+// with non-blocking writes at their drain rate for -t seconds, then reads the
+// scheduler's counters from debugfs before and after and prints how many
+// hrtimer callbacks served how many device ticks, and what that cost per
+// drained byte.
+//
+//   insmod hw82.ko ndevices=10000
+//   make bench && ./bench_timer -n 10000 -r 100 -b 10
+//
+// The device nodes are created in a temporary directory, so this needs root;
+// the major number is looked up in /proc/devices unless -m gives it.
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/types.h>
+
+// From hw82.c
+struct fifo_rate {
+    __u32 rate;
+    __u32 burst;
+};
+
+#define FIFO_START_TIMER _IO('p', 1)
+#define FIFO_STOP_TIMER _IO('p', 2)
+#define FIFO_SET_RATE _IOW('p', 3, struct fifo_rate)
+
+#define SCHED_STATS "/sys/kernel/debug/pchar_timer/sched"
+#define FEED_MS 10  // how often every device gets its share of bytes
+
+static unsigned int ndevices = 10000;
+static unsigned int major_num;
+static struct fifo_rate rate = { .rate = 100, .burst = 10 };
+static double seconds = 5.0;
+
+// Scheduler totals, the "total:" line of SCHED_STATS
+struct sched_totals {
+    unsigned long long fires, ticks, bytes, ns;
+};
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int read_totals(struct sched_totals *t)
+{
+    char line[256];
+    FILE *f = fopen(SCHED_STATS, "r");
+    int found = 0;
+
+    if (!f)
+        return -1;
+    while (fgets(line, sizeof(line), f))
+        if (sscanf(line, "total: fires=%llu ticks=%llu bytes=%llu ns=%llu", &t->fires,
+                   &t->ticks, &t->bytes, &t->ns) == 4)
+            found = 1;
+    fclose(f);
+    return found ? 0 : -1;
+}
+
+// Last "pchar" entry of /proc/devices; hw7.c and hw72.c use the same name
+static unsigned int find_major(void)
+{
+    char line[128], name[64];
+    unsigned int major, found = 0;
+    FILE *f = fopen("/proc/devices", "r");
+
+    if (!f)
+        return 0;
+    while (fgets(line, sizeof(line), f))
+        if (sscanf(line, "%u %63s", &major, name) == 2 && !strcmp(name, "pchar"))
+            found = major;
+    fclose(f);
+    return found;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-n devices] [-m major] [-r bytes/s per device] "
+            "[-b burst bytes] [-t seconds]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    char dir[] = "/tmp/bench_timer.XXXXXX", path[64];
+    struct rlimit rl;
+    struct sched_totals before, after;
+    double start, elapsed, next;
+    unsigned long long offered = 0, fires, ticks, bytes, ns;
+    unsigned int i, feed;
+    char *buf;
+    ssize_t n;
+    int *fds;
+    int opt, ret = 1;
+
+    while ((opt = getopt(argc, argv, "n:m:r:b:t:")) != -1) {
+        switch (opt) {
+            case 'n':
+                ndevices = atoi(optarg);
+                break;
+            case 'm':
+                major_num = atoi(optarg);
+                break;
+            case 'r':
+                rate.rate = atoi(optarg);
+                break;
+            case 'b':
+                rate.burst = atoi(optarg);
+                break;
+            case 't':
+                seconds = atof(optarg);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (!ndevices || !rate.rate || !rate.burst || seconds <= 0)
+        usage(argv[0]);
+    if (!major_num)
+        major_num = find_major();
+    if (!major_num) {
+        fprintf(stderr, "pchar is not in /proc/devices, give its major with -m\n");
+        return 1;
+    }
+
+    // One descriptor per device
+    rl.rlim_cur = rl.rlim_max = ndevices + 64;
+    if (setrlimit(RLIMIT_NOFILE, &rl))
+        perror("setrlimit, keeping the current descriptor limit");
+
+    // Bytes per device per feeding round, at least one
+    feed = rate.rate * FEED_MS / 1000;
+    if (!feed)
+        feed = 1;
+    fds = calloc(ndevices, sizeof(*fds));
+    buf = malloc(feed);
+    if (!fds || !buf || !mkdtemp(dir)) {
+        perror("setup");
+        return 1;
+    }
+    memset(buf, 't', feed);
+    for (i = 0; i < ndevices; i++)
+        fds[i] = -1;
+
+    for (i = 0; i < ndevices; i++) {
+        snprintf(path, sizeof(path), "%s/%u", dir, i);
+        if (mknod(path, S_IFCHR | 0600, makedev(major_num, i))) {
+            perror(path);
+            goto out;
+        }
+        fds[i] = open(path, O_WRONLY | O_NONBLOCK);
+        unlink(path);
+        if (fds[i] < 0) {
+            perror(path);
+            goto out;
+        }
+        if (ioctl(fds[i], FIFO_SET_RATE, &rate) || ioctl(fds[i], FIFO_START_TIMER)) {
+            perror("FIFO_SET_RATE/FIFO_START_TIMER");
+            goto out;
+        }
+    }
+
+    if (read_totals(&before)) {
+        fprintf(stderr, "cannot read %s, is debugfs mounted?\n", SCHED_STATS);
+        goto out;
+    }
+
+    // Offer each device about its drain rate; a full FIFO just skips a round
+    start = next = now();
+    do {
+        for (i = 0; i < ndevices; i++) {
+            n = write(fds[i], buf, feed);
+            if (n > 0)
+                offered += n;
+        }
+        next += FEED_MS / 1000.0;
+        elapsed = now() - start;
+        if (next > start + elapsed)
+            usleep((next - start - elapsed) * 1e6);
+    } while (now() - start < seconds);
+    elapsed = now() - start;
+
+    if (read_totals(&after)) {
+        fprintf(stderr, "cannot read %s\n", SCHED_STATS);
+        goto out;
+    }
+
+    fires = after.fires - before.fires;
+    ticks = after.ticks - before.ticks;
+    bytes = after.bytes - before.bytes;
+    ns = after.ns - before.ns;
+    printf("devices=%u rate=%u burst=%u seconds=%.1f\n", ndevices, rate.rate, rate.burst,
+           elapsed);
+    printf("written=%llu drained=%llu (%.0f bytes/s)\n", offered, bytes, bytes / elapsed);
+    printf("timer fires=%llu (%.0f/s) device ticks=%llu ticks_per_fire=%.1f\n", fires,
+           fires / elapsed, ticks, fires ? (double)ticks / fires : 0);
+    printf("callback time=%.3f ms (%.3f%% of one CPU) ns_per_tick=%.0f ns_per_byte=%.1f\n",
+           ns / 1e6, ns / (elapsed * 1e7), ticks ? (double)ns / ticks : 0,
+           bytes ? (double)ns / bytes : 0);
+    ret = 0;
+
+out:
+    for (i = 0; i < ndevices; i++) {
+        if (fds[i] >= 0) {
+            ioctl(fds[i], FIFO_STOP_TIMER);
+            close(fds[i]);
+        }
+    }
+    rmdir(dir);
+    free(buf);
+    free(fds);
+    return ret;
+}
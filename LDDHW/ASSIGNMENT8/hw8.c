@@ -1,34 +1,284 @@
 #include <linux/module.h>
 #include <linux/kthread.h>
 #include <linux/delay.h>
+#include <linux/percpu.h>
+#include <linux/cpumask.h>
+#include <linux/cpuhotplug.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
-// thread function
-static int print_numbers(void *data) {
+#include "hw8.h"
+
+/*
+ * Worker pool: one kthread pinned to each online CPU, each with its own
+ * queue of struct desd_work. Submitters queue on their own CPU by default;
+ * a worker with nothing queued steals the oldest item from another CPU's
+ * queue before going to sleep, and a submit that leaves a backlog wakes a
+ * neighbour so it can do so.
+ *
+ * Workers follow CPU hotplug: one is started when a CPU comes online, and
+ * when it goes offline its queue is handed to another CPU's worker before
+ * the thread is stopped.
+ */
+struct desd_worker {
+    spinlock_t lock;
+    struct list_head items;
+    unsigned int nr;          // items queued
+    bool dead;                // thread has exited, submits fail
+    bool kicked;              // woken to look for work to steal
+    wait_queue_head_t wq;
+    struct task_struct *task;
+    int cpu;
+    // Statistics, updated by the worker itself
+    u64 done;                 // items run
+    u64 stolen;               // of those, taken from another CPU
+    u64 latency_ns;           // total submit-to-start time
+    u64 max_latency_ns;
+};
+static DEFINE_PER_CPU(struct desd_worker, desd_workers);
+static struct cpumask desd_cpus;  // CPUs with a worker
+static int desd_hp_state;         // dynamic cpuhp state of the callbacks below
+static struct dentry *desd_debugfs;
+
+// Pop the oldest item of a worker's queue
+static struct desd_work *desd_take(struct desd_worker *w) {
+    struct desd_work *work = NULL;
+    unsigned long flags;
+
+    spin_lock_irqsave(&w->lock, flags);
+    if (w->nr) {
+        work = list_first_entry(&w->items, struct desd_work, entry);
+        list_del(&work->entry);
+        w->nr--;
+    }
+    spin_unlock_irqrestore(&w->lock, flags);
+    return work;
+}
+
+// Take an item from the next CPU that has any queued, after our own
+static struct desd_work *desd_steal(struct desd_worker *self) {
+    struct desd_work *work;
+    int cpu;
+
+    for_each_cpu_wrap(cpu, &desd_cpus, self->cpu + 1) {
+        if (cpu == self->cpu)
+            continue;
+        // Unlocked peek; desd_take rechecks under the lock
+        if (!READ_ONCE(per_cpu_ptr(&desd_workers, cpu)->nr))
+            continue;
+        work = desd_take(per_cpu_ptr(&desd_workers, cpu));
+        if (work)
+            return work;
+    }
+    return NULL;
+}
+
+static void desd_run(struct desd_worker *w, struct desd_work *work, bool stolen) {
+    u64 latency = ktime_get_ns() - work->queued_ns;
+
+    w->done++;
+    w->stolen += stolen;
+    w->latency_ns += latency;
+    w->max_latency_ns = max(w->max_latency_ns, latency);
+    work->fn(work);
+}
+
+// thread function: run own items, then stolen ones, then sleep
+static int desd_worker_fn(void *data) {
+    struct desd_worker *w = data;
+    struct desd_work *work;
+
+    for (;;) {
+        work = desd_take(w);
+        if (work) {
+            desd_run(w, work, false);
+            continue;
+        }
+        // A stopping worker only empties its own queue, or it could keep
+        // its CPU from going offline for as long as others are busy
+        work = kthread_should_stop() ? NULL : desd_steal(w);
+        if (work) {
+            desd_run(w, work, true);
+            continue;
+        }
+
+        if (kthread_should_stop()) {
+            // Leave only once nothing can be queued here any more
+            spin_lock_irq(&w->lock);
+            if (!w->nr) {
+                w->dead = true;
+                spin_unlock_irq(&w->lock);
+                break;
+            }
+            spin_unlock_irq(&w->lock);
+            continue;
+        }
+
+        wait_event_interruptible(w->wq, READ_ONCE(w->nr) || READ_ONCE(w->kicked) ||
+                                        kthread_should_stop());
+        WRITE_ONCE(w->kicked, false);
+    }
+    return 0;
+}
+
+// Queue work on a CPU's worker; see hw8.h
+int desd_pool_submit(struct desd_work *work, int cpu) {
+    struct desd_worker *w, *peer;
+    unsigned long flags;
+    unsigned int nr;
+    int next;
+
+    if (cpu < 0) {
+        cpu = raw_smp_processor_id();
+        // Submitted from a CPU on its way offline: any other worker will do
+        if (!cpumask_test_cpu(cpu, &desd_cpus))
+            cpu = cpumask_first(&desd_cpus);
+    }
+    if (cpu >= nr_cpu_ids || !cpumask_test_cpu(cpu, &desd_cpus))
+        return -EINVAL;
+    w = per_cpu_ptr(&desd_workers, cpu);
+
+    work->queued_ns = ktime_get_ns();
+    // Callable from any context, timers and interrupts included
+    spin_lock_irqsave(&w->lock, flags);
+    if (w->dead) {
+        spin_unlock_irqrestore(&w->lock, flags);
+        return -ESHUTDOWN;
+    }
+    list_add_tail(&work->entry, &w->items);
+    nr = ++w->nr;
+    spin_unlock_irqrestore(&w->lock, flags);
+    wake_up(&w->wq);
+
+    // A backlog is building: let the next worker come and steal
+    if (nr > 1) {
+        next = cpumask_next_wrap(cpu, &desd_cpus, cpu, false);
+        if (next < nr_cpu_ids && next != cpu) {
+            peer = per_cpu_ptr(&desd_workers, next);
+            WRITE_ONCE(peer->kicked, true);
+            wake_up(&peer->wq);
+        }
+    }
+    return 0;
+}
+EXPORT_SYMBOL_GPL(desd_pool_submit);
+
+// debugfs: per-worker counters and dispatch latency
+static int desd_pool_show(struct seq_file *m, void *v) {
+    int cpu;
+
+    for_each_cpu(cpu, &desd_cpus) {
+        struct desd_worker *w = per_cpu_ptr(&desd_workers, cpu);
+        u64 done = READ_ONCE(w->done);
+
+        seq_printf(m, "cpu%d: queued=%u done=%llu stolen=%llu avg_latency_ns=%llu max_latency_ns=%llu\n",
+                   cpu, READ_ONCE(w->nr), done, READ_ONCE(w->stolen),
+                   done ? div64_u64(READ_ONCE(w->latency_ns), done) : 0,
+                   READ_ONCE(w->max_latency_ns));
+    }
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(desd_pool);
+
+// demo work: the old numthread loop, now stopped early on unload
+static struct desd_work demo_work;
+
+static void print_numbers(struct desd_work *work) {
     int i;
-    for(i=1; i<=10; i++) {
+    for(i=1; i<=10 && !kthread_should_stop(); i++) {
         pr_info("%s: kthread (%d) running %d.\n", THIS_MODULE->name, current->pid, i);
         msleep(1000);  // Use msleep() instead of mdelay()
     }
+}
+
+// cpuhp callback, run for every online CPU at load and then on hotplug
+static int desd_cpu_online(unsigned int cpu) {
+    struct desd_worker *w = per_cpu_ptr(&desd_workers, cpu);
+    struct task_struct *task;
+
+    task = kthread_create_on_cpu(desd_worker_fn, w, cpu, "desd/%u");
+    if (IS_ERR(task)) {
+        pr_err("%s: failed to create the worker for cpu%u\n", THIS_MODULE->name, cpu);
+        return PTR_ERR(task);
+    }
+    w->dead = false;
+    w->kicked = false;
+    w->task = task;
+    cpumask_set_cpu(cpu, &desd_cpus);
+    wake_up_process(task);
+    return 0;
+}
+
+// cpuhp callback: hand the queue to another worker, then stop this one.
+// Anything queued after the splice is still run by the exiting worker.
+static int desd_cpu_offline(unsigned int cpu) {
+    struct desd_worker *w = per_cpu_ptr(&desd_workers, cpu), *to;
+    unsigned long flags;
+    unsigned int next;
+
+    cpumask_clear_cpu(cpu, &desd_cpus);
+    next = cpumask_first(&desd_cpus);
+    if (next < nr_cpu_ids) {
+        to = per_cpu_ptr(&desd_workers, next);
+        // Hotplug callbacks are serialized, so only one splice runs at a time
+        spin_lock_irqsave(&w->lock, flags);
+        spin_lock_nested(&to->lock, SINGLE_DEPTH_NESTING);
+        list_splice_tail_init(&w->items, &to->items);
+        to->nr += w->nr;
+        w->nr = 0;
+        spin_unlock(&to->lock);
+        spin_unlock_irqrestore(&w->lock, flags);
+        wake_up(&to->wq);
+    }
+    kthread_stop(w->task);
+    w->task = NULL;
     return 0;
 }
 
 static int __init desd_init(void) {
-    struct task_struct *task;
+    struct desd_worker *w;
+    int cpu, ret;
+
     pr_info("%s: desd_init() called.\n", THIS_MODULE->name);
-    // start the thread
-    task = kthread_run(print_numbers, NULL, "numthread");
-    pr_info("%s: new kernel thread created %d\n", THIS_MODULE->name, task->pid);
+
+    for_each_possible_cpu(cpu) {
+        w = per_cpu_ptr(&desd_workers, cpu);
+        spin_lock_init(&w->lock);
+        INIT_LIST_HEAD(&w->items);
+        init_waitqueue_head(&w->wq);
+        w->cpu = cpu;
+    }
+
+    // start one pinned worker per online CPU, and keep doing so on hotplug;
+    // on failure the workers already started are stopped again
+    ret = cpuhp_setup_state(CPUHP_AP_ONLINE_DYN, "desd:online", desd_cpu_online, desd_cpu_offline);
+    if (ret < 0)
+        return ret;
+    desd_hp_state = ret;
+    pr_info("%s: %u pool workers started\n", THIS_MODULE->name, cpumask_weight(&desd_cpus));
+
+    desd_debugfs = debugfs_create_dir("desd", NULL);
+    debugfs_create_file("pool", 0444, desd_debugfs, NULL, &desd_pool_fops);
+
+    demo_work.fn = print_numbers;
+    desd_pool_submit(&demo_work, -1);
     return 0;
 }
 
 static void __exit desd_exit(void) {
     pr_info("%s: desd_exit() called.\n", THIS_MODULE->name);
+    debugfs_remove_recursive(desd_debugfs);
+    // each worker passes its queue on and exits; the last one runs what is left
+    cpuhp_remove_state(desd_hp_state);
 }
 
 module_init(desd_init);
 module_exit(desd_exit);
 
 MODULE_LICENSE("GPL");
-MODULE_DESCRIPTION("Simple Kernel thread demo using msleep");
+MODULE_DESCRIPTION("Per-CPU kernel thread worker pool");
 MODULE_AUTHOR("shantanu ghadge <shantanughadge6@.com>");
-
@@ -0,0 +1,19 @@
+#ifndef _HW8_H
+#define _HW8_H
+
+#include <linux/list.h>
+#include <linux/types.h>
+
+// A unit of work for the hw8 per-CPU worker pool. The submitter owns the
+// memory; it must stay valid until fn has been called, and fn may free it.
+struct desd_work {
+    struct list_head entry;
+    void (*fn)(struct desd_work *work);
+    u64 queued_ns;  // set by desd_pool_submit, for dispatch latency
+};
+
+// Queue work on a CPU's worker (cpu < 0: the submitting CPU). Idle workers
+// steal from busy ones, so it may run elsewhere. -ESHUTDOWN while unloading.
+int desd_pool_submit(struct desd_work *work, int cpu);
+
+#endif /* _HW8_H */
@@ -4,8 +4,24 @@
 #include <linux/fs.h>
 #include <linux/uaccess.h>
 #include <linux/ioctl.h>
-#include <linux/timer.h>
+#include <linux/hrtimer.h>
+#include <linux/timerqueue.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
 #include <linux/sched.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/uio.h>
+#include <linux/workqueue.h>
+#include <linux/log2.h>
+#include <linux/percpu.h>
+#include <linux/vmalloc.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+#define CREATE_TRACE_POINTS
+#include "hw82_trace.h"
 
 #define DEVICE_NAME "pchar"
 #define FIFO_SIZE 256
@@ -13,94 +29,567 @@
 // Define ioctl commands
 #define FIFO_START_TIMER _IO('p', 1)
 #define FIFO_STOP_TIMER _IO('p', 2)
+#define FIFO_SET_RATE _IOW('p', 3, struct fifo_rate)
+#define FIFO_SET_POLL _IOW('p', 4, struct fifo_poll)
+
+// Drain rate for FIFO_SET_RATE: a token bucket refilled at 'rate' bytes per
+// second that holds at most 'burst' bytes. The timer ticks every burst / rate
+// seconds, so the defaults (1, 1) drain one character per second.
+struct fifo_rate {
+    __u32 rate;   // bytes per second, at least 1
+    __u32 burst;  // bytes per tick at most, 1 .. FIFO_SIZE - 1
+};
+
+// Adaptive draining for FIFO_SET_POLL, in the style of NAPI: every tick or
+// poll pass drains at most 'budget' bytes. Once a tick leaves more than
+// 'threshold' bytes queued the engine stops shaping and polls from a work
+// item, one budget per pass, until a pass comes up short; then it goes back
+// to timer ticks. threshold 0 never polls.
+struct fifo_poll {
+    __u32 budget;     // 1 .. FIFO_SIZE - 1
+    __u32 threshold;  // 0 .. FIFO_SIZE - 1
+};
+
+// Shortest tick we allow, however high the rate
+#define FIFO_MIN_PERIOD_NS (10 * NSEC_PER_USEC)
+
+// Number of devices, minors 0 .. ndevices - 1 of our major
+static unsigned int ndevices = 1;
+module_param(ndevices, uint, 0444);
+MODULE_PARM_DESC(ndevices, "Number of FIFO devices (1-65536)");
+
+// Batch statistics, shown summed over all devices in /sys/kernel/debug/pchar_timer/stats
+#define DRAIN_HIST 9  // bucket 0: empty batch, bucket i: [2^(i-1), 2^i) bytes
+struct drain_stats {
+    u64 ticks, polls;         // timer-driven and polled batches
+    u64 bytes;
+    u64 to_poll, to_timer;    // mode switches
+    u64 hist[DRAIN_HIST];
+};
+
+/*
+ * One shared drain scheduler per CPU. Devices due for a tick sit in 'queue'
+ * ordered by expiry, and one hrtimer is programmed to the earliest of them;
+ * its callback ticks every device that is due and re-queues them. A device
+ * joins the queue of the CPU that arms it, so adds are always local; only
+ * FIFO_STOP_TIMER removes entries from other CPUs' queues.
+ */
+struct drain_sched {
+    spinlock_t lock;
+    struct timerqueue_head queue;
+    struct hrtimer timer;
+    bool in_callback;  // the callback reprograms the timer itself when done
+    // Timer overhead, shown in /sys/kernel/debug/pchar_timer/sched
+    u64 fires;         // callback runs
+    u64 serviced;      // device ticks done by those runs
+    u64 bytes;         // bytes those ticks drained
+    u64 ns;            // time spent in the callback
+};
+static DEFINE_PER_CPU(struct drain_sched, drain_scheds);
+
+// Per-device state
+struct fifo_dev {
+    unsigned int id;  // minor number
+
+    // FIFO buffer: writers (one at a time, under wr_lock) fill at fifo_tail
+    // and the drain engine empties at fifo_head. Each side only stores its
+    // own index, so they need no common lock. One slot stays free to tell
+    // full from empty.
+    char mybuf[FIFO_SIZE];
+    int fifo_head;
+    int fifo_tail;
+
+    // Serializes writers, who may sleep on wr_wq until the engine makes room
+    struct mutex wr_lock;
+    wait_queue_head_t wr_wq;
+
+    // Serializes start/stop/rate changes against each other
+    struct mutex ctl_lock;
+
+    // Drain engine state. Ticks run in softirq context, so it is guarded by
+    // a spinlock taken with spin_lock_bh() from process context.
+    spinlock_t lock;
+    bool timer_running;  // started with FIFO_START_TIMER
+    bool timer_armed;    // queued on a scheduler, or being ticked by one
+    bool polling;        // poll_work owns draining, the device is not queued
+    u32 drain_rate;
+    u32 drain_burst;
+    ktime_t drain_period;
+    u64 tokens;          // bytes allowed now, times NSEC_PER_SEC
+    ktime_t last_refill;
+    u32 drain_budget;
+    u32 poll_threshold;
+    struct work_struct poll_work;
+    struct drain_stats stats;
+
+    // Scheduler entry; 'sched' is set while queued, under that scheduler's lock
+    struct timerqueue_node node;
+    struct drain_sched *sched;
+};
 
-// FIFO buffer
-static char mybuf[FIFO_SIZE];
-static int fifo_head = 0;
-static int fifo_tail = 0;
+static struct fifo_dev *fifo_devs;
+static struct dentry *drain_debugfs;
 
-// Timer for periodic removal of characters
-static struct timer_list fifo_timer;
-static bool timer_running = false;
+// Major number for the device
+static int major_num;
 
-// Mutex for protecting FIFO access
-static DEFINE_MUTEX(fifo_mutex);
+// Bytes waiting in mybuf
+static unsigned int fifo_len(int head, int tail)
+{
+    return (tail - head + FIFO_SIZE) % FIFO_SIZE;
+}
 
-// Function to log character and update FIFO
-static void log_and_remove_char(struct work_struct *work)
+// Bytes queued on a device, as seen by the drain side
+static unsigned int fifo_queued(struct fifo_dev *dev)
 {
+    return fifo_len(dev->fifo_head, smp_load_acquire(&dev->fifo_tail));
+}
+
+// Add the tokens earned since the last refill (dev->lock held)
+static void fifo_refill(struct fifo_dev *dev)
+{
+    ktime_t now = ktime_get();
+    u64 cap = (u64)dev->drain_burst * NSEC_PER_SEC;
+    s64 elapsed = ktime_to_ns(ktime_sub(now, dev->last_refill));
+
+    dev->last_refill = now;
+    // A full period or more always fills the bucket; rate * elapsed stays
+    // below cap otherwise, so it cannot overflow
+    if (elapsed >= ktime_to_ns(dev->drain_period))
+        dev->tokens = cap;
+    else
+        dev->tokens = min(dev->tokens + (u64)dev->drain_rate * elapsed, cap);
+}
+
+// Put a device on this CPU's scheduler, due at 'expires' (dev->lock held, bh off)
+static void fifo_queue(struct fifo_dev *dev, ktime_t expires)
+{
+    struct drain_sched *s = this_cpu_ptr(&drain_scheds);
+
+    spin_lock(&s->lock);
+    dev->node.expires = expires;
+    WRITE_ONCE(dev->sched, s);
+    // Reprogram only for a new earliest entry, and never under the callback
+    if (timerqueue_add(&s->queue, &dev->node) && !s->in_callback)
+        hrtimer_start(&s->timer, expires, HRTIMER_MODE_ABS_PINNED_SOFT);
+    spin_unlock(&s->lock);
+}
+
+// Take a device off its scheduler if it is still queued there (dev->lock held).
+// Returns false when a callback already picked it up and will finish the tick.
+static bool fifo_dequeue(struct fifo_dev *dev)
+{
+    struct drain_sched *s = READ_ONCE(dev->sched);
+    bool queued = false;
+
+    // Only a callback can clear 'sched' behind our back; nobody else can set it
+    if (!s)
+        return false;
+    spin_lock(&s->lock);
+    if (dev->sched == s) {
+        timerqueue_del(&s->queue, &dev->node);
+        WRITE_ONCE(dev->sched, NULL);
+        queued = true;
+    }
+    spin_unlock(&s->lock);
+    return queued;
+}
+
+// Schedule the first tick, right away if a byte's worth of tokens is ready (dev->lock held)
+static void fifo_arm(struct fifo_dev *dev)
+{
+    fifo_refill(dev);
+    dev->timer_armed = true;
+    fifo_queue(dev, dev->tokens >= NSEC_PER_SEC ? dev->last_refill :
+                    ktime_add(dev->last_refill, dev->drain_period));
+}
+
+// Remove up to 'max' bytes from mybuf and count the batch (dev->lock held)
+static unsigned int fifo_drain(struct fifo_dev *dev, unsigned int max, bool polled)
+{
+    int head = dev->fifo_head;
+    int tail = smp_load_acquire(&dev->fifo_tail);
+    unsigned int n = min(max, fifo_len(head, tail));
+    unsigned int i;
     char c;
-    mutex_lock(&fifo_mutex);
-    if (fifo_head != fifo_tail) {
-        c = mybuf[fifo_head];
-        fifo_head = (fifo_head + 1) % FIFO_SIZE;
-        pr_info("FIFO: removed character: '%c'\n", c);
+
+    for (i = 0; i < n; i++) {
+        c = dev->mybuf[head];
+        head = (head + 1) % FIFO_SIZE;
+        trace_pchar_timer_drain(dev->id, c, fifo_len(head, tail));
     }
-    mutex_unlock(&fifo_mutex);
+    // Hand the slots back to writers only after reading them
+    smp_store_release(&dev->fifo_head, head);
+
+    if (polled)
+        dev->stats.polls++;
+    else
+        dev->stats.ticks++;
+    dev->stats.bytes += n;
+    dev->stats.hist[n ? min(ilog2(n) + 1, DRAIN_HIST - 1) : 0]++;
+    trace_pchar_timer_batch(dev->id, n, fifo_len(head, tail), polled);
+    if (n)
+        wake_up_interruptible(&dev->wr_wq);
+    return n;
+}
 
-    // If FIFO is empty, stop the timer
-    if (fifo_head == fifo_tail) {
-        pr_info("FIFO is empty. Stopping timer.\n");
-        del_timer_sync(&fifo_timer);
-        timer_running = false;
+// One timer tick of a device: drain what the bucket and the budget allow, then
+// re-queue it, idle it or hand it to the poll loop (dev->lock held)
+static unsigned int fifo_tick(struct fifo_dev *dev)
+{
+    unsigned int n, queued;
+
+    if (!dev->timer_running) {
+        dev->timer_armed = false;
+        return 0;
+    }
+
+    fifo_refill(dev);
+    n = fifo_drain(dev, min_t(u64, div_u64(dev->tokens, NSEC_PER_SEC), dev->drain_budget),
+                   false);
+    dev->tokens -= (u64)n * NSEC_PER_SEC;
+    queued = fifo_queued(dev);
+
+    if (!queued) {
+        // If FIFO is empty, idle until a writer re-arms the device
+        dev->timer_armed = false;
+    } else if (dev->poll_threshold && queued > dev->poll_threshold) {
+        // Producers are outrunning the ticks: hand over to the poll loop
+        dev->timer_armed = false;
+        dev->polling = true;
+        dev->stats.to_poll++;
+        queue_work(system_highpri_wq, &dev->poll_work);
+    } else {
+        fifo_queue(dev, ktime_add(dev->last_refill, dev->drain_period));
     }
+    return n;
 }
 
-// Timer callback function
-static void fifo_timer_callback(struct timer_list *t)
+// Scheduler callback: tick every device that is due, then sleep until the next one
+static enum hrtimer_restart drain_sched_callback(struct hrtimer *t)
 {
-    struct work_struct *work = (struct work_struct *)t;
-    log_and_remove_char(work);
-    // Restart timer if FIFO is not empty
-    if (fifo_head != fifo_tail) {
-        mod_timer(&fifo_timer, jiffies + msecs_to_jiffies(1000)); // 1 second delay
+    struct drain_sched *s = container_of(t, struct drain_sched, timer);
+    struct timerqueue_node *node;
+    struct fifo_dev *dev;
+    ktime_t start = ktime_get();
+    unsigned int serviced = 0, bytes = 0;
+    enum hrtimer_restart ret = HRTIMER_NORESTART;
+
+    spin_lock(&s->lock);
+    s->in_callback = true;
+    // Devices re-queued below are due after 'start', so each ticks once per run
+    while ((node = timerqueue_getnext(&s->queue)) && ktime_compare(node->expires, start) <= 0) {
+        timerqueue_del(&s->queue, node);
+        dev = container_of(node, struct fifo_dev, node);
+        WRITE_ONCE(dev->sched, NULL);
+        spin_unlock(&s->lock);
+
+        // Lock order is dev->lock, then the scheduler lock
+        spin_lock(&dev->lock);
+        bytes += fifo_tick(dev);
+        spin_unlock(&dev->lock);
+        serviced++;
+
+        spin_lock(&s->lock);
+    }
+    if (node) {
+        hrtimer_set_expires(t, node->expires);
+        ret = HRTIMER_RESTART;
     }
+    s->in_callback = false;
+    s->fires++;
+    s->serviced += serviced;
+    s->bytes += bytes;
+    s->ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+    spin_unlock(&s->lock);
+
+    return ret;
+}
+
+// Poll mode: drain one budget per pass and requeue while passes come back full
+static void fifo_poll_work(struct work_struct *work)
+{
+    struct fifo_dev *dev = container_of(work, struct fifo_dev, poll_work);
+    unsigned int n;
+
+    spin_lock_bh(&dev->lock);
+    if (!dev->timer_running) {
+        dev->polling = false;
+        spin_unlock_bh(&dev->lock);
+        return;
+    }
+
+    n = fifo_drain(dev, dev->drain_budget, true);
+    if (n < dev->drain_budget) {
+        // Backlog cleared: back to timer ticks, or idle if nothing is left
+        dev->polling = false;
+        dev->stats.to_timer++;
+        if (fifo_queued(dev))
+            fifo_arm(dev);
+    } else {
+        queue_work(system_highpri_wq, &dev->poll_work);
+    }
+    spin_unlock_bh(&dev->lock);
+}
+
+// Wake the drain engine after a write, if it is started but idle
+static void fifo_kick(struct fifo_dev *dev)
+{
+    spin_lock_bh(&dev->lock);
+    if (dev->timer_running && !dev->timer_armed && !dev->polling)
+        fifo_arm(dev);
+    spin_unlock_bh(&dev->lock);
+}
+
+// Set the token bucket; takes effect from the next tick
+static int fifo_set_rate(struct fifo_dev *dev, struct fifo_rate *r)
+{
+    if (!r->rate || !r->burst || r->burst >= FIFO_SIZE)
+        return -EINVAL;
+
+    spin_lock_bh(&dev->lock);
+    fifo_refill(dev);
+    dev->drain_rate = r->rate;
+    dev->drain_burst = r->burst;
+    dev->drain_period = ns_to_ktime(max_t(u64, div_u64((u64)r->burst * NSEC_PER_SEC, r->rate),
+                                          FIFO_MIN_PERIOD_NS));
+    dev->tokens = min(dev->tokens, (u64)dev->drain_burst * NSEC_PER_SEC);
+    spin_unlock_bh(&dev->lock);
+    return 0;
 }
 
+// Set the per-pass budget and the poll threshold
+static int fifo_set_poll(struct fifo_dev *dev, struct fifo_poll *p)
+{
+    if (!p->budget || p->budget >= FIFO_SIZE || p->threshold >= FIFO_SIZE)
+        return -EINVAL;
+
+    spin_lock_bh(&dev->lock);
+    dev->drain_budget = p->budget;
+    dev->poll_threshold = p->threshold;
+    spin_unlock_bh(&dev->lock);
+    return 0;
+}
+
+// Start draining a device; only this device's state is touched
+static void fifo_start(struct fifo_dev *dev)
+{
+    spin_lock_bh(&dev->lock);
+    if (!dev->timer_running) {
+        pr_debug("pchar%u: starting the timer\n", dev->id);
+        dev->timer_running = true;
+        // Start with an empty bucket, as the old timer waited a full period
+        dev->tokens = 0;
+        dev->last_refill = ktime_get();
+        if (!dev->timer_armed && !dev->polling && fifo_queued(dev))
+            fifo_arm(dev);
+    } else {
+        pr_debug("pchar%u: timer is already running\n", dev->id);
+    }
+    spin_unlock_bh(&dev->lock);
+}
+
+// Stop draining a device and wait until its poll work is done
+static void fifo_stop(struct fifo_dev *dev)
+{
+    spin_lock_bh(&dev->lock);
+    if (dev->timer_running) {
+        pr_debug("pchar%u: stopping the timer\n", dev->id);
+        dev->timer_running = false;
+        // A callback holding the device already sees timer_running clear
+        // and drops timer_armed itself
+        if (fifo_dequeue(dev))
+            dev->timer_armed = false;
+    } else {
+        pr_debug("pchar%u: timer is not running\n", dev->id);
+    }
+    spin_unlock_bh(&dev->lock);
+
+    // The poll work takes dev->lock, so cancel without it
+    cancel_work_sync(&dev->poll_work);
+}
+
+// debugfs: batch counters and batch size histogram, summed over all devices
+static int drain_stats_show(struct seq_file *m, void *v)
+{
+    struct drain_stats sum = {};
+    unsigned int i, j, npolling = 0;
+
+    for (i = 0; i < ndevices; i++) {
+        struct fifo_dev *dev = &fifo_devs[i];
+
+        spin_lock_bh(&dev->lock);
+        sum.ticks += dev->stats.ticks;
+        sum.polls += dev->stats.polls;
+        sum.bytes += dev->stats.bytes;
+        sum.to_poll += dev->stats.to_poll;
+        sum.to_timer += dev->stats.to_timer;
+        for (j = 0; j < DRAIN_HIST; j++)
+            sum.hist[j] += dev->stats.hist[j];
+        npolling += dev->polling;
+        spin_unlock_bh(&dev->lock);
+    }
+
+    seq_printf(m, "polling=%u ticks=%llu polls=%llu bytes=%llu to_poll=%llu to_timer=%llu\n",
+               npolling, sum.ticks, sum.polls, sum.bytes, sum.to_poll, sum.to_timer);
+    seq_printf(m, "%8s bytes: %llu\n", "0", sum.hist[0]);
+    for (i = 1; i < DRAIN_HIST; i++)
+        seq_printf(m, "%4u-%-3u bytes: %llu\n", 1U << (i - 1),
+                   i == DRAIN_HIST - 1 ? FIFO_SIZE - 1 : (1U << i) - 1, sum.hist[i]);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(drain_stats);
+
+// debugfs: per-CPU scheduler overhead, and callback time per drained byte
+static int drain_sched_show(struct seq_file *m, void *v)
+{
+    u64 fires = 0, serviced = 0, bytes = 0, ns = 0;
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        struct drain_sched *s = per_cpu_ptr(&drain_scheds, cpu);
+        u64 f, sv, b, t;
+
+        spin_lock_bh(&s->lock);
+        f = s->fires;
+        sv = s->serviced;
+        b = s->bytes;
+        t = s->ns;
+        spin_unlock_bh(&s->lock);
+        if (!f)
+            continue;
+        seq_printf(m, "cpu%d: fires=%llu ticks=%llu bytes=%llu ns=%llu\n", cpu, f, sv, b, t);
+        fires += f;
+        serviced += sv;
+        bytes += b;
+        ns += t;
+    }
+    seq_printf(m, "total: fires=%llu ticks=%llu bytes=%llu ns=%llu ticks_per_fire=%llu ns_per_byte=%llu\n",
+               fires, serviced, bytes, ns, fires ? div64_u64(serviced, fires) : 0,
+               bytes ? div64_u64(ns, bytes) : 0);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(drain_sched);
+
 // Open function for the character device
 static int pchar_open(struct inode *inode, struct file *file)
 {
-    pr_info("pchar: device opened\n");
+    struct fifo_dev *dev = &fifo_devs[iminor(inode)];
+
+    file->private_data = dev;
+    // write_iter honours IOCB_NOWAIT, so io_uring may issue writes inline
+    file->f_mode |= FMODE_NOWAIT;
+    pr_debug("pchar%u: device opened\n", dev->id);
     return 0;
 }
 
 // Release function for the character device
 static int pchar_release(struct inode *inode, struct file *file)
 {
-    pr_info("pchar: device closed\n");
+    struct fifo_dev *dev = file->private_data;
+
+    pr_debug("pchar%u: device closed\n", dev->id);
     return 0;
 }
 
+// Write function: queue bytes for the drain engine, blocking while mybuf is full
+static ssize_t pchar_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+    struct fifo_dev *dev = iocb->ki_filp->private_data;
+    bool nonblock = (iocb->ki_filp->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT);
+    size_t count = iov_iter_count(from);
+    size_t written = 0, n, chunk, copied;
+    int head, tail, ret = 0;
+
+    if (!count)
+        return 0;
+
+    if (iocb->ki_flags & IOCB_NOWAIT) {
+        if (!mutex_trylock(&dev->wr_lock))
+            return -EAGAIN;
+    } else if (mutex_lock_interruptible(&dev->wr_lock)) {
+        return -ERESTARTSYS;
+    }
+
+    while (written < count) {
+        tail = dev->fifo_tail;
+        head = smp_load_acquire(&dev->fifo_head);
+        n = FIFO_SIZE - 1 - fifo_len(head, tail);
+        if (!n) {
+            if (nonblock) {
+                ret = -EAGAIN;
+                break;
+            }
+            if (wait_event_interruptible(dev->wr_wq,
+                    fifo_len(smp_load_acquire(&dev->fifo_head), tail) < FIFO_SIZE - 1)) {
+                ret = -ERESTARTSYS;
+                break;
+            }
+            continue;
+        }
+
+        // Copy straight from the source, in two pieces if the space wraps
+        n = min(n, count - written);
+        chunk = min_t(size_t, n, FIFO_SIZE - tail);
+        copied = copy_from_iter(dev->mybuf + tail, chunk, from);
+        if (copied == chunk && n > chunk)
+            copied += copy_from_iter(dev->mybuf, n - chunk, from);
+        if (!copied) {
+            ret = -EFAULT;
+            break;
+        }
+        smp_store_release(&dev->fifo_tail, (tail + copied) % FIFO_SIZE);
+        written += copied;
+        fifo_kick(dev);
+        if (copied < n) {
+            ret = -EFAULT;
+            break;
+        }
+    }
+    mutex_unlock(&dev->wr_lock);
+
+    // Bytes already queued are reported even if a signal or fault cut us short
+    return written ? written : ret;
+}
+
 // ioctl implementation
 static long pchar_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
+    struct fifo_dev *dev = file->private_data;
+    struct fifo_rate rate;
+    struct fifo_poll poll;
+    int ret = 0;
+
+    mutex_lock(&dev->ctl_lock);
     switch (cmd) {
         case FIFO_START_TIMER:
-            if (!timer_running) {
-                pr_info("Starting the timer...\n");
-                timer_setup(&fifo_timer, fifo_timer_callback, 0);
-                mod_timer(&fifo_timer, jiffies + msecs_to_jiffies(1000)); // 1 second delay
-                timer_running = true;
-            } else {
-                pr_info("Timer is already running.\n");
-            }
+            fifo_start(dev);
             break;
 
         case FIFO_STOP_TIMER:
-            if (timer_running) {
-                pr_info("Stopping the timer...\n");
-                del_timer_sync(&fifo_timer);
-                timer_running = false;
-            } else {
-                pr_info("Timer is not running.\n");
-            }
+            fifo_stop(dev);
+            break;
+
+        case FIFO_SET_RATE:
+            if (copy_from_user(&rate, (void __user *)arg, sizeof(rate)))
+                ret = -EFAULT;
+            else
+                ret = fifo_set_rate(dev, &rate);
+            break;
+
+        case FIFO_SET_POLL:
+            if (copy_from_user(&poll, (void __user *)arg, sizeof(poll)))
+                ret = -EFAULT;
+            else
+                ret = fifo_set_poll(dev, &poll);
             break;
 
         default:
-            return -EINVAL;  // Invalid command
+            ret = -EINVAL;  // Invalid command
     }
+    mutex_unlock(&dev->ctl_lock);
 
-    return 0;
+    return ret;
 }
 
 // File operations structure
@@ -108,25 +597,81 @@ static const struct file_operations pchar_fops = {
     .owner = THIS_MODULE,
     .open = pchar_open,
     .release = pchar_release,
+    .write_iter = pchar_write_iter,
     .unlocked_ioctl = pchar_ioctl,  // For ioctl calls
 };
 
+// Set up one device with the old defaults: one character per second
+static void fifo_dev_init(struct fifo_dev *dev, unsigned int id)
+{
+    dev->id = id;
+    mutex_init(&dev->wr_lock);
+    init_waitqueue_head(&dev->wr_wq);
+    mutex_init(&dev->ctl_lock);
+    spin_lock_init(&dev->lock);
+    dev->drain_rate = 1;
+    dev->drain_burst = 1;
+    dev->drain_period = ns_to_ktime(NSEC_PER_SEC);
+    dev->drain_budget = FIFO_SIZE - 1;
+    INIT_WORK(&dev->poll_work, fifo_poll_work);
+    timerqueue_init(&dev->node);
+}
+
 // Registering the device
 static int __init pchar_init(void)
 {
-    int result;
-    result = register_chrdev(0, DEVICE_NAME, &pchar_fops);  // Registering with dynamic major number
+    unsigned int i;
+    int result, cpu;
+
+    if (!ndevices || ndevices > 65536) {
+        pr_err("pchar: ndevices must be 1-65536\n");
+        return -EINVAL;
+    }
+
+    for_each_possible_cpu(cpu) {
+        struct drain_sched *s = per_cpu_ptr(&drain_scheds, cpu);
+
+        spin_lock_init(&s->lock);
+        timerqueue_init_head(&s->queue);
+        hrtimer_init(&s->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS_PINNED_SOFT);
+        s->timer.function = drain_sched_callback;
+    }
+
+    fifo_devs = vzalloc(array_size(ndevices, sizeof(*fifo_devs)));
+    if (!fifo_devs)
+        return -ENOMEM;
+    for (i = 0; i < ndevices; i++)
+        fifo_dev_init(&fifo_devs[i], i);
+
+    // Registering with dynamic major number, one minor per device
+    result = __register_chrdev(0, 0, ndevices, DEVICE_NAME, &pchar_fops);
     if (result < 0) {
         pr_err("pchar: failed to register a device\n");
+        vfree(fifo_devs);
         return result;
     }
-    pr_info("pchar: registered with major number %d\n", result);
+    major_num = result;
+    drain_debugfs = debugfs_create_dir("pchar_timer", NULL);
+    debugfs_create_file("stats", 0444, drain_debugfs, NULL, &drain_stats_fops);
+    debugfs_create_file("sched", 0444, drain_debugfs, NULL, &drain_sched_fops);
+    pr_info("pchar: registered %u devices with major number %d\n", ndevices, result);
     return 0;
 }
 
 static void __exit pchar_exit(void)
 {
-    unregister_chrdev(0, DEVICE_NAME);  // Unregister the device
+    unsigned int i;
+    int cpu;
+
+    __unregister_chrdev(major_num, 0, ndevices, DEVICE_NAME);  // Unregister the devices
+    debugfs_remove_recursive(drain_debugfs);
+
+    // No file is open any more, so nothing can restart a device
+    for (i = 0; i < ndevices; i++)
+        fifo_stop(&fifo_devs[i]);
+    for_each_possible_cpu(cpu)
+        hrtimer_cancel(&per_cpu_ptr(&drain_scheds, cpu)->timer);
+    vfree(fifo_devs);
     pr_info("pchar: unregistered the device\n");
 }
 
@@ -136,4 +681,3 @@ module_exit(pchar_exit);
 MODULE_LICENSE("GPL");
 MODULE_DESCRIPTION("Character Driver with FIFO and Timer");
 MODULE_AUTHOR("shantanu ghadge <shantanughadge6@gmail.com>");
-
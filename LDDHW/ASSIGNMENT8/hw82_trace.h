@@ -0,0 +1,53 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM pchar_timer
+
+#if !defined(_HW82_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _HW82_TRACE_H
+
+#include <linux/tracepoint.h>
+
+// A character drained from a device's mybuf; 'queued' is what is left
+TRACE_EVENT(pchar_timer_drain,
+    TP_PROTO(unsigned int id, char c, unsigned int queued),
+    TP_ARGS(id, c, queued),
+    TP_STRUCT__entry(
+        __field(unsigned int, id)
+        __field(char, c)
+        __field(unsigned int, queued)
+    ),
+    TP_fast_assign(
+        __entry->id = id;
+        __entry->c = c;
+        __entry->queued = queued;
+    ),
+    TP_printk("dev=%u char='%c' queued=%u", __entry->id, __entry->c, __entry->queued)
+);
+
+// One drain batch, from a timer tick or a poll pass
+TRACE_EVENT(pchar_timer_batch,
+    TP_PROTO(unsigned int id, unsigned int bytes, unsigned int queued, bool polled),
+    TP_ARGS(id, bytes, queued, polled),
+    TP_STRUCT__entry(
+        __field(unsigned int, id)
+        __field(unsigned int, bytes)
+        __field(unsigned int, queued)
+        __field(bool, polled)
+    ),
+    TP_fast_assign(
+        __entry->id = id;
+        __entry->bytes = bytes;
+        __entry->queued = queued;
+        __entry->polled = polled;
+    ),
+    TP_printk("dev=%u bytes=%u queued=%u mode=%s", __entry->id, __entry->bytes,
+              __entry->queued, __entry->polled ? "poll" : "timer")
+);
+
+#endif /* _HW82_TRACE_H */
+
+// This part must be outside the header guard
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE hw82_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,442 @@
+#include <linux/module.h>
+#include <linux/kthread.h>
+#include <linux/delay.h>
+#include <linux/kfifo.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/log2.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+/*
+ * FIFO benchmark: N producer and M consumer kthreads (as in hw8.c) hammer
+ * one of the buffer backends used by the drivers, from inside the kernel so
+ * no syscall cost hides the buffer's own. Producers serialize on one lock
+ * and consumers on another, the way hw.c and hw7.c guard their FIFOs.
+ *
+ *   echo 1 > /sys/kernel/debug/fifo_bench/run     # blocks for duration_ms
+ *   cat /sys/kernel/debug/fifo_bench/results
+ */
+
+enum bench_backend {
+    BENCH_KFIFO,   // kfifo, as hw7.c
+    BENCH_RING,    // hand-rolled mybuf ring with modulo indices, as hw82.c
+    BENCH_RESIZE,  // pseudo ring resized under load, as hw.c fifo_resize
+    BENCH_PSEUDO,  // any-size ring with per-side offsets, as hw.c struct pseudo_fifo
+};
+static const char * const backend_names[] = { "kfifo", "ring", "resize", "pseudo" };
+
+static unsigned int producers = 1;
+module_param(producers, uint, 0644);
+MODULE_PARM_DESC(producers, "Producer threads");
+
+static unsigned int consumers = 1;
+module_param(consumers, uint, 0644);
+MODULE_PARM_DESC(consumers, "Consumer threads");
+
+static unsigned int fifo_size = 1024;
+module_param(fifo_size, uint, 0644);
+MODULE_PARM_DESC(fifo_size, "Buffer bytes (a power of two for kfifo)");
+
+static unsigned int chunk = 64;
+module_param(chunk, uint, 0644);
+MODULE_PARM_DESC(chunk, "Bytes per producer or consumer operation");
+
+static unsigned int duration_ms = 1000;
+module_param(duration_ms, uint, 0644);
+MODULE_PARM_DESC(duration_ms, "Length of one run");
+
+static unsigned int backend;
+module_param(backend, uint, 0644);
+MODULE_PARM_DESC(backend, "0 = kfifo, 1 = ring, 2 = pseudo resized under load, 3 = pseudo");
+
+static unsigned int resize_ms = 10;
+module_param(resize_ms, uint, 0644);
+MODULE_PARM_DESC(resize_ms, "Resize interval for backend 2");
+
+#define BENCH_MAX_THREADS 64
+
+// Per-thread results
+struct bench_thread {
+    struct task_struct *task;
+    bool producer;
+    u64 ops;         // successful operations
+    u64 bytes;
+    u64 ns;          // time spent inside operations, failed ones included
+    u64 contended;   // the side lock was busy when we came for it
+    u64 retries;     // buffer full (producer) or empty (consumer)
+};
+
+// Copy of hw.c's struct pseudo_fifo: free-running in/out plus the buffer
+// offset each side points at, so the size need not be a power of two
+struct bench_pfifo {
+    unsigned char *data;
+    unsigned int size;
+    unsigned int in ____cacheline_aligned_in_smp;
+    unsigned int in_off;
+    unsigned int out ____cacheline_aligned_in_smp;
+    unsigned int out_off;
+};
+
+// The buffer under test and its two side locks
+static struct {
+    struct kfifo fifo;            // BENCH_KFIFO
+    char *ring;                   // BENCH_RING
+    struct bench_pfifo pfifo;     // BENCH_PSEUDO, BENCH_RESIZE
+    unsigned int head, tail;      // ring indices, head is read
+    unsigned int ring_size;
+    struct mutex rd_lock, wr_lock;
+    u64 resizes;
+    // Parameters of this run, copied once so later writes to them are harmless
+    unsigned int producers, consumers, fifo_size, chunk;
+} bench;
+
+static struct bench_thread bench_threads[BENCH_MAX_THREADS];
+static unsigned int bench_nthreads;
+static struct task_struct *resizer;
+static u64 bench_elapsed_ns;
+static enum bench_backend bench_backend_used;
+static DEFINE_MUTEX(bench_run_lock);  // one run at a time, results stable while shown
+static struct dentry *bench_debugfs;
+
+// Take a side lock, counting the times it was already held
+static void bench_lock(struct mutex *lock, struct bench_thread *t) {
+    if (!mutex_trylock(lock)) {
+        t->contended++;
+        mutex_lock(lock);
+    }
+}
+
+// hw82-style ring: one slot stays free to tell full from empty
+static unsigned int ring_in(const char *buf, unsigned int len) {
+    unsigned int head = smp_load_acquire(&bench.head), tail = bench.tail;
+    unsigned int space = (head - tail - 1 + bench.ring_size) % bench.ring_size;
+    unsigned int i;
+
+    len = min(len, space);
+    for (i = 0; i < len; i++)
+        bench.ring[(tail + i) % bench.ring_size] = buf[i];
+    smp_store_release(&bench.tail, (tail + len) % bench.ring_size);
+    return len;
+}
+
+static unsigned int ring_out(char *buf, unsigned int len) {
+    unsigned int tail = smp_load_acquire(&bench.tail), head = bench.head;
+    unsigned int used = (tail - head + bench.ring_size) % bench.ring_size;
+    unsigned int i;
+
+    len = min(len, used);
+    for (i = 0; i < len; i++)
+        buf[i] = bench.ring[(head + i) % bench.ring_size];
+    smp_store_release(&bench.head, (head + len) % bench.ring_size);
+    return len;
+}
+
+// Buffer offset 'delta' bytes past 'off', as hw.c fifo_wrap
+static unsigned int pfifo_wrap(struct bench_pfifo *f, unsigned int off, unsigned int delta) {
+    off += delta;
+    return off >= f->size ? off - f->size : off;
+}
+
+// hw.c fifo_from_iter with a kernel buffer: at most two copies
+static unsigned int pfifo_in(const char *buf, unsigned int len) {
+    struct bench_pfifo *f = &bench.pfifo;
+    unsigned int l;
+
+    len = min(len, f->size - (f->in - smp_load_acquire(&f->out)));
+    l = min(len, f->size - f->in_off);
+    memcpy(f->data + f->in_off, buf, l);
+    memcpy(f->data, buf + l, len - l);
+    f->in_off = pfifo_wrap(f, f->in_off, len);
+    smp_store_release(&f->in, f->in + len);
+    return len;
+}
+
+// hw.c fifo_to_iter with a kernel buffer
+static unsigned int pfifo_out(char *buf, unsigned int len) {
+    struct bench_pfifo *f = &bench.pfifo;
+    unsigned int l;
+
+    len = min(len, smp_load_acquire(&f->in) - f->out);
+    l = min(len, f->size - f->out_off);
+    memcpy(buf, f->data + f->out_off, l);
+    memcpy(buf + l, f->data, len - l);
+    f->out_off = pfifo_wrap(f, f->out_off, len);
+    smp_store_release(&f->out, f->out + len);
+    return len;
+}
+
+static unsigned int bench_in(const char *buf, unsigned int len) {
+    if (bench_backend_used == BENCH_RING)
+        return ring_in(buf, len);
+    if (bench_backend_used == BENCH_KFIFO)
+        return kfifo_in(&bench.fifo, buf, len);
+    return pfifo_in(buf, len);
+}
+
+static unsigned int bench_out(char *buf, unsigned int len) {
+    if (bench_backend_used == BENCH_RING)
+        return ring_out(buf, len);
+    if (bench_backend_used == BENCH_KFIFO)
+        return kfifo_out(&bench.fifo, buf, len);
+    return pfifo_out(buf, len);
+}
+
+// thread function: one producer or consumer, looping until stopped
+static int bench_fn(void *data) {
+    struct bench_thread *t = data;
+    void *buf;
+    unsigned int n;
+    u64 start;
+
+    buf = kmalloc(bench.chunk, GFP_KERNEL);
+    if (!buf)
+        goto idle;
+    memset(buf, 'x', bench.chunk);
+
+    while (!kthread_should_stop()) {
+        start = ktime_get_ns();
+        if (t->producer) {
+            bench_lock(&bench.wr_lock, t);
+            n = bench_in(buf, bench.chunk);
+            mutex_unlock(&bench.wr_lock);
+        } else {
+            bench_lock(&bench.rd_lock, t);
+            n = bench_out(buf, bench.chunk);
+            mutex_unlock(&bench.rd_lock);
+        }
+        t->ns += ktime_get_ns() - start;
+
+        if (n) {
+            t->ops++;
+            t->bytes += n;
+        } else {
+            t->retries++;
+            cond_resched();
+        }
+    }
+    kfree(buf);
+    return 0;
+
+idle:
+    // Stay around for kthread_stop, which must not find us gone
+    while (!kthread_should_stop())
+        msleep(10);
+    return -ENOMEM;
+}
+
+// Resize the pseudo ring under load, keeping its contents, like hw.c
+// fifo_resize: allocate and free outside the locks, copy only queued bytes
+static int bench_resize_fn(void *data) {
+    struct bench_pfifo *f = &bench.pfifo;
+    unsigned int size = bench.fifo_size;
+    unsigned int len, l;
+    unsigned char *buf;
+
+    while (!kthread_should_stop()) {
+        msleep(resize_ms);
+        // Alternate between the configured size and twice that
+        size = size == bench.fifo_size ? bench.fifo_size * 2 : bench.fifo_size;
+        buf = kvmalloc(size, GFP_KERNEL);
+        if (!buf)
+            continue;
+
+        mutex_lock(&bench.rd_lock);
+        mutex_lock(&bench.wr_lock);
+        len = f->in - f->out;
+        // A shrink that would drop queued bytes is skipped, as hw.c fails it with -ENOSPC
+        if (len <= size) {
+            l = min(len, f->size - f->out_off);
+            memcpy(buf, f->data + f->out_off, l);
+            memcpy(buf + l, f->data, len - l);
+            swap(f->data, buf);
+            f->size = size;
+            f->out = f->out_off = 0;
+            f->in = len;
+            f->in_off = pfifo_wrap(f, 0, len);
+            bench.resizes++;
+        }
+        mutex_unlock(&bench.wr_lock);
+        mutex_unlock(&bench.rd_lock);
+
+        kvfree(buf);
+    }
+    return 0;
+}
+
+static void bench_stop_threads(void) {
+    unsigned int i;
+
+    if (resizer)
+        kthread_stop(resizer);
+    resizer = NULL;
+    for (i = 0; i < bench_nthreads; i++)
+        kthread_stop(bench_threads[i].task);
+}
+
+// One benchmark run with the current module parameters
+static int bench_run(void) {
+    unsigned int nprod = READ_ONCE(producers), ncons = READ_ONCE(consumers);
+    unsigned int size = READ_ONCE(fifo_size), len = READ_ONCE(chunk);
+    unsigned int type = READ_ONCE(backend);
+    struct task_struct *task;
+    unsigned int i;
+    u64 start;
+    int ret = 0;
+
+    if (!nprod || !ncons || nprod + ncons > BENCH_MAX_THREADS || !len || size < 2 ||
+        type > BENCH_PSEUDO || (type == BENCH_KFIFO && !is_power_of_2(size)) ||
+        (type == BENCH_RESIZE && size > INT_MAX / 2))
+        return -EINVAL;
+
+    memset(&bench, 0, sizeof(bench));
+    memset(bench_threads, 0, sizeof(bench_threads));
+    bench_nthreads = 0;
+    bench_elapsed_ns = 0;
+    bench_backend_used = type;
+    bench.producers = nprod;
+    bench.consumers = ncons;
+    bench.fifo_size = size;
+    bench.chunk = len;
+    mutex_init(&bench.rd_lock);
+    mutex_init(&bench.wr_lock);
+    if (type == BENCH_RING) {
+        bench.ring = kmalloc(size, GFP_KERNEL);
+        bench.ring_size = size;
+        if (!bench.ring)
+            return -ENOMEM;
+    } else if (type == BENCH_KFIFO) {
+        if (kfifo_alloc(&bench.fifo, size, GFP_KERNEL))
+            return -ENOMEM;
+    } else {
+        bench.pfifo.data = kvmalloc(size, GFP_KERNEL);
+        bench.pfifo.size = size;
+        if (!bench.pfifo.data)
+            return -ENOMEM;
+    }
+
+    // start the threads, consumers first so nothing sits in a full buffer
+    start = ktime_get_ns();
+    for (i = 0; i < nprod + ncons; i++) {
+        struct bench_thread *t = &bench_threads[i];
+
+        t->producer = i >= ncons;
+        task = kthread_run(bench_fn, t, "fifo_bench/%c%u", t->producer ? 'p' : 'c',
+                           t->producer ? i - ncons : i);
+        if (IS_ERR(task)) {
+            ret = PTR_ERR(task);
+            goto out;
+        }
+        t->task = task;
+        bench_nthreads++;
+    }
+    if (type == BENCH_RESIZE) {
+        task = kthread_run(bench_resize_fn, NULL, "fifo_bench/resize");
+        if (IS_ERR(task)) {
+            ret = PTR_ERR(task);
+            goto out;
+        }
+        resizer = task;
+    }
+
+    msleep_interruptible(duration_ms);
+
+out:
+    bench_stop_threads();
+    bench_elapsed_ns = ktime_get_ns() - start;
+    if (type == BENCH_RING)
+        kfree(bench.ring);
+    else if (type == BENCH_KFIFO)
+        kfifo_free(&bench.fifo);
+    else
+        kvfree(bench.pfifo.data);
+    return ret;
+}
+
+// debugfs: any write to 'run' starts a run and returns when it is over
+static ssize_t bench_run_write(struct file *file, const char __user *buf, size_t count,
+                               loff_t *ppos) {
+    int ret;
+
+    if (mutex_lock_interruptible(&bench_run_lock))
+        return -ERESTARTSYS;
+    ret = bench_run();
+    mutex_unlock(&bench_run_lock);
+    return ret ? ret : count;
+}
+
+static const struct file_operations bench_run_fops = {
+    .owner = THIS_MODULE,
+    .write = bench_run_write,
+};
+
+// debugfs: per-thread and total ns/op, throughput and contention
+static int bench_results_show(struct seq_file *m, void *v) {
+    u64 ops[2] = {}, bytes[2] = {}, ns[2] = {}, contended[2] = {}, retries[2] = {};
+    unsigned int i;
+    int side;
+
+    mutex_lock(&bench_run_lock);
+    if (!bench_elapsed_ns) {
+        seq_puts(m, "no run yet\n");
+        goto out;
+    }
+
+    seq_printf(m, "backend=%s fifo_size=%u chunk=%u producers=%u consumers=%u elapsed_ms=%llu",
+               backend_names[bench_backend_used], bench.fifo_size, bench.chunk,
+               bench.producers, bench.consumers,
+               div_u64(bench_elapsed_ns, NSEC_PER_MSEC));
+    if (bench_backend_used == BENCH_RESIZE)
+        seq_printf(m, " resizes=%llu", bench.resizes);
+    seq_putc(m, '\n');
+
+    for (i = 0; i < bench_nthreads; i++) {
+        struct bench_thread *t = &bench_threads[i];
+
+        side = t->producer;
+        seq_printf(m, "%s%u: ops=%llu bytes=%llu ns_per_op=%llu contended=%llu %s=%llu\n",
+                   side ? "producer" : "consumer", side ? i - bench.consumers : i, t->ops, t->bytes,
+                   t->ops ? div64_u64(t->ns, t->ops) : 0, t->contended,
+                   side ? "full" : "empty", t->retries);
+        ops[side] += t->ops;
+        bytes[side] += t->bytes;
+        ns[side] += t->ns;
+        contended[side] += t->contended;
+        retries[side] += t->retries;
+    }
+
+    for (side = 1; side >= 0; side--)
+        seq_printf(m, "%s total: ops=%llu MB_per_s=%llu ns_per_op=%llu contended=%llu %s=%llu\n",
+                   side ? "producer" : "consumer", ops[side],
+                   div64_u64(bytes[side] * 1000, bench_elapsed_ns),
+                   ops[side] ? div64_u64(ns[side], ops[side]) : 0, contended[side],
+                   side ? "full" : "empty", retries[side]);
+out:
+    mutex_unlock(&bench_run_lock);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(bench_results);
+
+static int __init bench_init(void) {
+    pr_info("%s: bench_init() called.\n", THIS_MODULE->name);
+    bench_debugfs = debugfs_create_dir("fifo_bench", NULL);
+    debugfs_create_file("run", 0200, bench_debugfs, NULL, &bench_run_fops);
+    debugfs_create_file("results", 0444, bench_debugfs, NULL, &bench_results_fops);
+    return 0;
+}
+
+static void __exit bench_exit(void) {
+    pr_info("%s: bench_exit() called.\n", THIS_MODULE->name);
+    // Removing the files waits for a run in progress to return
+    debugfs_remove_recursive(bench_debugfs);
+}
+
+module_init(bench_init);
+module_exit(bench_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("In-kernel FIFO backend benchmark using kernel threads");
+MODULE_AUTHOR("shantanu ghadge <shantanughadge6@.com>");
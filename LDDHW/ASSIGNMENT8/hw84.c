@@ -0,0 +1,282 @@
+#include <linux/module.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/atomic.h>
+#include <linux/vmalloc.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/delay.h>
+#include <linux/cpumask.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+#include "hw8.h"
+
+/*
+ * Worker pool benchmark for hw8.c. Needs hw8.ko loaded first. Each run does:
+ *  - lone items: one submitter queues an item and waits for it to run before
+ *    queueing the next, so the latency is pure dispatch: wakeup and switch
+ *  - floods with 1, 2, 4, ... submitter kthreads, each pinned to its own
+ *    CPU and queueing 'items' items as fast as it can; the pool's items per
+ *    second should grow with the submitters while CPUs are left
+ *
+ * The Makefile builds it next to hw8.ko, which exports desd_pool_submit():
+ *
+ *   insmod hw8.ko && insmod hw84.ko items=100000
+ *   echo 1 > /sys/kernel/debug/desd_bench/run     # blocks until done
+ *   cat /sys/kernel/debug/desd_bench/results
+ */
+
+static unsigned int items = 100000;
+module_param(items, uint, 0644);
+MODULE_PARM_DESC(items, "Items each submitter queues per flood");
+
+static unsigned int lone_items = 10000;
+module_param(lone_items, uint, 0644);
+MODULE_PARM_DESC(lone_items, "Items for the lone item latency test");
+
+static unsigned int work_ns;
+module_param(work_ns, uint, 0644);
+MODULE_PARM_DESC(work_ns, "Busy time of each item in ns (0 = empty item)");
+
+#define BENCH_MAX_SUBMITTERS 64U
+#define BENCH_MAX_STEPS 8  // lone items, then 1, 2, 4, ... 64 submitters
+
+struct bench_item {
+    struct desd_work work;
+    struct completion *done;  // lone items only
+};
+
+// One flood or the lone item test
+struct bench_step {
+    unsigned int submitters;  // 0 = lone items
+    u64 items;
+    u64 ns;                   // first submit to last item run
+    u64 lat_ns, max_lat_ns;   // dispatch latency, summed and worst
+    int err;
+};
+
+// State shared with the items while a step runs
+static struct {
+    atomic64_t left;          // items not run yet
+    atomic64_t lat_ns;
+    atomic64_t max_lat_ns;
+    u64 last_ns;              // when the last item ran
+    struct completion all_done;
+    unsigned int per_submitter;
+    struct bench_item *items;
+} bench;
+
+static struct bench_step bench_steps[BENCH_MAX_STEPS];
+static unsigned int bench_nsteps;
+static DEFINE_MUTEX(bench_run_lock);  // one run at a time, results stable while shown
+static struct dentry *bench_debugfs;
+
+// Count 'nr' items as finished; the last one stamps the end of the step
+static void bench_put(u64 nr) {
+    if (atomic64_sub_and_test(nr, &bench.left)) {
+        WRITE_ONCE(bench.last_ns, ktime_get_ns());
+        complete(&bench.all_done);
+    }
+}
+
+static void bench_item_fn(struct desd_work *work) {
+    struct bench_item *item = container_of(work, struct bench_item, work);
+    u64 now = ktime_get_ns(), lat = now - work->queued_ns;
+    s64 max = atomic64_read(&bench.max_lat_ns);
+
+    atomic64_add(lat, &bench.lat_ns);
+    while (lat > max) {
+        s64 old = atomic64_cmpxchg(&bench.max_lat_ns, max, lat);
+
+        if (old == max)
+            break;
+        max = old;
+    }
+    if (work_ns)
+        ndelay(work_ns);
+
+    if (item->done)
+        complete(item->done);
+    else
+        bench_put(1);
+}
+
+// thread function: queue this submitter's share of the items on its own CPU
+static int bench_submit_fn(void *data) {
+    struct bench_item *item = data;
+    unsigned int i;
+    int ret = 0;
+
+    for (i = 0; i < bench.per_submitter && !ret; i++, item++) {
+        item->work.fn = bench_item_fn;
+        ret = desd_pool_submit(&item->work, -1);
+    }
+    // Items that could not be queued will never count themselves down
+    if (ret)
+        bench_put(bench.per_submitter - i + 1);
+
+    // Stay around for kthread_stop, which must not find us gone
+    while (!kthread_should_stop())
+        msleep(1);
+    return ret;
+}
+
+static void bench_reset(struct bench_step *step) {
+    atomic64_set(&bench.lat_ns, 0);
+    atomic64_set(&bench.max_lat_ns, 0);
+    init_completion(&bench.all_done);
+    memset(step, 0, sizeof(*step));
+}
+
+// Lone items: queue one, wait for it, repeat
+static void bench_lone(struct bench_step *step) {
+    struct bench_item item = {};
+    DECLARE_COMPLETION_ONSTACK(done);
+    u64 start = ktime_get_ns();
+    unsigned int i;
+
+    bench_reset(step);
+    item.done = &done;
+    item.work.fn = bench_item_fn;
+    for (i = 0; i < lone_items; i++) {
+        reinit_completion(&done);
+        step->err = desd_pool_submit(&item.work, -1);
+        if (step->err)
+            break;
+        wait_for_completion(&done);
+    }
+    step->items = i;
+    step->ns = ktime_get_ns() - start;
+    step->lat_ns = atomic64_read(&bench.lat_ns);
+    step->max_lat_ns = atomic64_read(&bench.max_lat_ns);
+}
+
+// Flood: 'n' pinned submitters each queue 'items' items at once
+static void bench_flood(struct bench_step *step, unsigned int n) {
+    struct task_struct *tasks[BENCH_MAX_SUBMITTERS] = {};
+    unsigned int i, started = 0;
+    u64 start;
+    int cpu;
+
+    bench_reset(step);
+    step->submitters = n;
+    bench.per_submitter = items;
+    // One extra count, dropped once every submitter has started
+    atomic64_set(&bench.left, (u64)n * items + 1);
+
+    start = ktime_get_ns();
+    cpu = cpumask_first(cpu_online_mask);
+    for (i = 0; i < n && cpu < nr_cpu_ids; i++, cpu = cpumask_next(cpu, cpu_online_mask)) {
+        tasks[i] = kthread_create_on_cpu(bench_submit_fn, &bench.items[i * items], cpu,
+                                         "desd_bench/%u");
+        if (IS_ERR(tasks[i])) {
+            step->err = PTR_ERR(tasks[i]);
+            tasks[i] = NULL;
+            break;
+        }
+        wake_up_process(tasks[i]);
+        started++;
+    }
+    // Submitters that never started will not queue their items
+    bench_put((u64)(n - started) * items + 1);
+
+    wait_for_completion(&bench.all_done);
+    for (i = 0; i < started; i++) {
+        int ret = kthread_stop(tasks[i]);
+
+        if (ret && !step->err)
+            step->err = ret;
+    }
+    step->items = (u64)started * items;
+    step->ns = READ_ONCE(bench.last_ns) - start;
+    step->lat_ns = atomic64_read(&bench.lat_ns);
+    step->max_lat_ns = atomic64_read(&bench.max_lat_ns);
+}
+
+// One benchmark run with the current module parameters
+static int bench_run(void) {
+    unsigned int max = min(num_online_cpus(), BENCH_MAX_SUBMITTERS), n;
+
+    if (!items || !lone_items)
+        return -EINVAL;
+    bench.items = vzalloc(array_size((size_t)max * items, sizeof(*bench.items)));
+    if (!bench.items)
+        return -ENOMEM;
+
+    bench_nsteps = 0;
+    bench_lone(&bench_steps[bench_nsteps++]);
+    for (n = 1; bench_nsteps < BENCH_MAX_STEPS; n = min(n * 2, max)) {
+        bench_flood(&bench_steps[bench_nsteps++], n);
+        if (n == max)
+            break;
+    }
+
+    vfree(bench.items);
+    bench.items = NULL;
+    return 0;
+}
+
+// debugfs: any write to 'run' starts a run and returns when it is over
+static ssize_t bench_run_write(struct file *file, const char __user *buf, size_t count,
+                               loff_t *ppos) {
+    int ret;
+
+    if (mutex_lock_interruptible(&bench_run_lock))
+        return -ERESTARTSYS;
+    ret = bench_run();
+    mutex_unlock(&bench_run_lock);
+    return ret ? ret : count;
+}
+
+static const struct file_operations bench_run_fops = {
+    .owner = THIS_MODULE,
+    .write = bench_run_write,
+};
+
+// debugfs: one line per step, items per second and dispatch latency
+static int bench_results_show(struct seq_file *m, void *v) {
+    unsigned int i;
+
+    mutex_lock(&bench_run_lock);
+    if (!bench_nsteps)
+        seq_puts(m, "no run yet\n");
+    for (i = 0; i < bench_nsteps; i++) {
+        struct bench_step *s = &bench_steps[i];
+
+        if (s->submitters)
+            seq_printf(m, "submitters=%u", s->submitters);
+        else
+            seq_puts(m, "lone");
+        seq_printf(m, " items=%llu items_per_s=%llu avg_latency_ns=%llu max_latency_ns=%llu",
+                   s->items, s->ns ? div64_u64(s->items * NSEC_PER_SEC, s->ns) : 0,
+                   s->items ? div64_u64(s->lat_ns, s->items) : 0, s->max_lat_ns);
+        if (s->err)
+            seq_printf(m, " err=%d", s->err);
+        seq_putc(m, '\n');
+    }
+    mutex_unlock(&bench_run_lock);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(bench_results);
+
+static int __init bench_init(void) {
+    pr_info("%s: bench_init() called.\n", THIS_MODULE->name);
+    bench_debugfs = debugfs_create_dir("desd_bench", NULL);
+    debugfs_create_file("run", 0200, bench_debugfs, NULL, &bench_run_fops);
+    debugfs_create_file("results", 0444, bench_debugfs, NULL, &bench_results_fops);
+    return 0;
+}
+
+static void __exit bench_exit(void) {
+    pr_info("%s: bench_exit() called.\n", THIS_MODULE->name);
+    // Removing the files waits for a run in progress to return
+    debugfs_remove_recursive(bench_debugfs);
+}
+
+module_init(bench_init);
+module_exit(bench_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Dispatch latency and scaling benchmark for the hw8 worker pool");
+MODULE_AUTHOR("shantanu ghadge <shantanughadge6@.com>");